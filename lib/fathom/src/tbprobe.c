@@ -294,6 +294,50 @@ static int numPaths = 0;
 static char *pathString = NULL;
 static char **paths = NULL;
 
+/*
+ * Tablebase files held in memory, registered with tb_add_memory_file. They are
+ * looked up by file name before the directories in the tablebase path.
+ */
+#define TB_MAX_MEMORY_FILES 1024
+
+struct MemoryFile {
+  char name[32];
+  const void *data;
+  size_t size;
+};
+
+static struct MemoryFile memoryFiles[TB_MAX_MEMORY_FILES];
+static int numMemoryFiles = 0;
+
+bool tb_add_memory_file(const char *name, const void *data, size_t size)
+{
+  if (numMemoryFiles >= TB_MAX_MEMORY_FILES || strlen(name) >= sizeof(memoryFiles[0].name))
+    return false;
+  struct MemoryFile *file = &memoryFiles[numMemoryFiles++];
+  strcpy(file->name, name);
+  file->data = data;
+  file->size = size;
+  return true;
+}
+
+static const struct MemoryFile *find_memory_file(const char *str, const char *suffix)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%s%s", str, suffix);
+  for (int i = 0; i < numMemoryFiles; i++)
+    if (!strcmp(memoryFiles[i].name, name))
+      return &memoryFiles[i];
+  return NULL;
+}
+
+static bool is_memory_file(const void *data)
+{
+  for (int i = 0; i < numMemoryFiles; i++)
+    if (memoryFiles[i].data == data)
+      return true;
+  return false;
+}
+
 static FD open_tb(const char *str, const char *suffix)
 {
   int i;
@@ -388,7 +432,7 @@ static void *map_file(FD fd, map_t *mapping)
 #ifndef _WIN32
 static void unmap_file(void *data, map_t size)
 {
-  if (!data) return;
+  if (!data || is_memory_file(data)) return;
   if (munmap(data, size) != 0) {
       perror("munmap");
   }
@@ -396,7 +440,7 @@ static void unmap_file(void *data, map_t size)
 #else
 static void unmap_file(void *data, map_t mapping)
 {
-  if (!data) return;
+  if (!data || is_memory_file(data)) return;
   if (!UnmapViewOfFile(data)) {
 	  fprintf(stderr, "unmap failed, error code %lu\n", GetLastError());
   }
@@ -690,6 +734,15 @@ static void prt_str(const Pos *pos, char *str, bool flip)
 
 static bool test_tb(const char *str, const char *suffix)
 {
+  const struct MemoryFile *memory = find_memory_file(str, suffix);
+  if (memory) {
+    if ((memory->size & 63) != 16) {
+      fprintf(stderr, "Incomplete tablebase file %s.%s\n", str, suffix);
+      return false;
+    }
+    return true;
+  }
+
   FD fd = open_tb(str, suffix);
   if (fd != FD_ERR) {
     size_t size = file_size(fd);
@@ -705,6 +758,12 @@ static bool test_tb(const char *str, const char *suffix)
 
 static void *map_tb(const char *name, const char *suffix, map_t *mapping)
 {
+  const struct MemoryFile *memory = find_memory_file(name, suffix);
+  if (memory) {
+    *mapping = 0;
+    return (void *)memory->data;
+  }
+
   FD fd = open_tb(name, suffix);
   if (fd == FD_ERR)
     return NULL;
@@ -866,16 +925,20 @@ bool tb_init(const char *path)
 
   TB_LARGEST = 0;
 
-  // if path is an empty string or equals "<empty>", we are done.
+  // if path is an empty string or equals "<empty>" and there are no
+  // tablebase files in memory, we are done.
   const char *p = path;
-  if (strlen(p) == 0 || !strcmp(p, "<empty>")) {
+  bool noPath = strlen(p) == 0 || !strcmp(p, "<empty>");
+  if (noPath && numMemoryFiles == 0) {
     return true;
   }
+  if (noPath)
+    p = "";
 
   pathString = (char*)malloc(strlen(p) + 1);
   strcpy(pathString, p);
   numPaths = 0;
-  for (int i = 0;; i++) {
+  for (int i = 0; !noPath; i++) {
     if (pathString[i] != SEP_CHAR)
       numPaths++;
     while (pathString[i] && pathString[i] != SEP_CHAR)
@@ -883,7 +946,7 @@ bool tb_init(const char *path)
     if (!pathString[i]) break;
     pathString[i] = 0;
   }
-  paths = (char**)malloc(numPaths * sizeof(*paths));
+  paths = (char**)malloc((numPaths + 1) * sizeof(*paths));
   for (int i = 0, j = 0; i < numPaths; i++) {
     while (!pathString[j]) j++;
     paths[i] = &pathString[j];
@@ -175,6 +175,25 @@ extern unsigned TB_LARGEST;
  */
 bool tb_init(const char *_path);
 
+/*
+ * Register a tablebase file held in memory, e.g. embedded in the executable.
+ *
+ * PARAMETERS:
+ * - name:
+ *   The file name including the suffix, e.g. "KQvK.rtbw".
+ * - data, size:
+ *   The file contents. They must stay valid and unchanged while the
+ *   tablebase is in use.
+ *
+ * Files in memory are found before files in the tablebase path. They are
+ * picked up by the next call to tb_init, which also accepts an empty path
+ * when only files in memory are used.
+ *
+ * RETURN:
+ * - true=succes, false=too many files or the name is too long.
+ */
+bool tb_add_memory_file(const char *name, const void *data, size_t size);
+
 /*
  * Free any resources allocated by tb_init
  */
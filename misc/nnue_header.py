@@ -0,0 +1,19 @@
+# Prepend the 64-byte Aku network header to a bullet weight file.
+# Usage: python nnue_header.py <hidden_size> <input.bin> <output.bin>
+import struct
+import sys
+
+MAGIC = b"AKUN"
+VERSION = 1
+
+hidden_size = int(sys.argv[1])
+with open(sys.argv[2], "rb") as f:
+    weights = f.read()
+
+expected = ((768 + 3) * hidden_size + 1) * 2
+if len(weights) < expected:
+    sys.exit(f"{sys.argv[2]} has {len(weights)} bytes, expected at least {expected} for hidden size {hidden_size}")
+
+header = struct.pack("<4sII52x", MAGIC, VERSION, hidden_size)
+with open(sys.argv[3], "wb") as f:
+    f.write(header + weights)
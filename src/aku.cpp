@@ -34,6 +34,7 @@
 #include <stdexcept> 
 #include <thread>
 #include <mutex>
+#include <functional>
 #include "assets.hpp"
 #include "syzygy.hpp"
 
@@ -137,74 +138,22 @@ int singular_c1 = 2;
 int singular_c2 = 0;
 int singular_bonus = 100;
 int max_extensions = 4;
+int syzygy_probe_depth = 1;
 
-// Extract tablebase files to the current directory if they don't already exist.
-void extract_files() {
-
-    std::string path = get_exec_path();
-    std::filesystem::path table_dir = std::filesystem::path(path) / "tables";
-
-    // Check if the "tables" folder exists, if not, create it
-    if (!std::filesystem::exists(table_dir)) {
-        std::cout << "Creating directory: " << table_dir << std::endl;
-        if (!std::filesystem::create_directories(table_dir)) {
-            std::cerr << "Failed to create directory: " << table_dir << std::endl;
-            return;
-        }
-    }
-
+// Register the embedded tablebases with fathom. They are probed in place, nothing is written to disk.
+void register_embedded_tables() {
     for (size_t i = 0; i < tablebaseFileCount; i++) {
-        std::string file_path = path + "/" + tablebaseFiles[i].name;
-
-        // Check if the file already exists
-        if (std::filesystem::exists(file_path)) {
-            continue;
-        }
-
-        // Create and write file only if it doesn't exist
-        std::ofstream out_file(file_path, std::ios::binary);
-        if (!out_file) {
-            std::cerr << "Failed to create: " << file_path << std::endl;
-            continue;
-        }
-
-        out_file.write(reinterpret_cast<const char*>(tablebaseFiles[i].data), tablebaseFiles[i].size);
-        out_file.close();
-        std::cout << "Extracted: " << file_path << std::endl;
-    }
-
-    // Ensure "nnue" directory exists
-    std::string nnue_dir = path + "/nnue";
-    if (!std::filesystem::exists(nnue_dir)) {
-        std::cout << "Creating directory: " << nnue_dir << std::endl;
-        if (!std::filesystem::create_directories(nnue_dir)) {
-            std::cerr << "Failed to create directory: " << nnue_dir << std::endl;
-            return;
-        }
+        syzygy::add_embedded_table(tablebaseFiles[i].name, tablebaseFiles[i].data, tablebaseFiles[i].size);
     }
-
-    // Extract NNUE weights file only if it doesn't already exist
-    std::string nnue_file_path = nnue_dir + "/" + nnueWeightFile.name;
-    if (!std::filesystem::exists(nnue_file_path)) {
-        std::ofstream nnue_out(nnue_file_path, std::ios::binary);
-        if (!nnue_out) {
-            std::cerr << "Failed to create: " << nnue_file_path << std::endl;
-        } else {
-            nnue_out.write(reinterpret_cast<const char*>(nnueWeightFile.data), nnueWeightFile.size);
-            nnue_out.close();
-            std::cout << "Extracted: " << nnue_file_path << std::endl;
-        }
-    } else {
-        std::cout << "NNUE file found." << nnue_file_path << std::endl;
-    }
-
 }
 
 // Global variables for engine options
 int num_threads = 4;
+int hash_size = 256; // Transposition table size in MB
 int depth = 99;
 bool chess960 = false;
 bool internal_opening = true;
+std::string syzygy_path = "<empty>"; // Directories with tablebases besides the embedded ones
 Board board;
 
 std::string get_book_move(Board& board) {
@@ -282,6 +231,27 @@ void process_position(const std::string& command) {
     }
 }
 
+// Splits a UCI command line into whitespace separated tokens.
+std::vector<std::string> split_args(const std::string& line) {
+    std::vector<std::string> tokens;
+    std::istringstream iss(line);
+    std::string token;
+    while (iss >> token) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Joins tokens[first..] with single spaces, for option values such as paths that may contain spaces.
+std::string join_args(const std::vector<std::string>& tokens, size_t first) {
+    std::string joined;
+    for (size_t i = first; i < tokens.size(); i++) {
+        if (i > first) joined += " ";
+        joined += tokens[i];
+    }
+    return joined;
+}
+
 // Processes the "setoption" command to configure engine options.
 void process_option(const std::vector<std::string>& tokens) {
 
@@ -289,17 +259,31 @@ void process_option(const std::vector<std::string>& tokens) {
     std::string value = tokens[4];
 
     if (option_name == "Threads") {
-        num_threads = std::stoi(value);
-        // Set number of threads
+        num_threads = std::clamp(std::stoi(value), 1, MAX_THREADS);
+        set_num_threads(num_threads);
     } else if (option_name == "Depth") {
         depth = std::stoi(value);
     } else if (option_name == "Hash") {
-        table_size = std::stoi(value) * 1024 * 1024 / 64;
+        hash_size = std::clamp(std::stoi(value), 1, MAX_HASH);
+        resize_table(hash_size, num_threads);
     } else if (option_name == "UCI_Chess960") {
         chess960 = (value == "true");
         board.set960(chess960);
     } else if (option_name == "Internal_Opening_Book") {
         internal_opening = (value == "true");
+    } else if (option_name == "SyzygyPath") {
+        syzygy_path = join_args(tokens, 4);
+        wait_search(); // Workers of a running search still probe the old tables
+        syzygy::initialize_syzygy(syzygy_path);
+    } else if (option_name == "SyzygyProbeDepth") {
+        syzygy_probe_depth = std::clamp(std::stoi(value), 0, 100);
+    } else if (option_name == "EvalFile") {
+        std::string path = join_args(tokens, 4);
+        bool loaded = (path == "<internal>") ? initialize_embedded_nnue(nnueWeightFile.data, nnueWeightFile.size)
+                                              : initialize_nnue(path);
+        if (!loaded) {
+            std::cout << "info string Failed to load " << path << ", keeping the current network" << std::endl;
+        }
     }  
     
     // For spsa tuning. Comment out for final build.
@@ -334,15 +318,9 @@ void process_option(const std::vector<std::string>& tokens) {
     }
 }
 
-// Make a thread for search. Mostly written by Jim Ablett.
-void search_thread(Board search_board, int search_depth, int time_limit) {
-    Move best_move = Move::NO_MOVE;
-    try {
-        best_move = lazysmp_root_search(search_board, num_threads, search_depth, time_limit);
-    } catch (...) {
-        // Handle any exceptions during search
-    }
-    
+// Report the result of a search started by process_go. Called by the search pool once all search threads
+// have stopped. Mostly written by Jim Ablett.
+void report_bestmove(Move best_move) {
     // Update shared data
     {
         std::lock_guard<std::mutex> lock(search_mutex);
@@ -363,6 +341,10 @@ void search_thread(Board search_board, int search_depth, int time_limit) {
 // Handles the "go" command to start the search.
 void process_go(const std::vector<std::string>& tokens) {
 
+    // A stopped search may still be unwinding. Let it report its bestmove before the flags are reset,
+    // otherwise its workers miss the stop.
+    wait_search();
+
     // Reset stop flags
     search_stopped = false;
     search_running = true;
@@ -441,9 +423,8 @@ void process_go(const std::vector<std::string>& tokens) {
         }        
     }
 
-    // Start search in a separate thread
-    std::thread t(search_thread, board, search_depth, time_limit);
-    t.detach();
+    // Wake up the search threads. The result is reported by report_bestmove.
+    start_search(board, num_threads, search_depth, time_limit, report_bestmove);
 }
 
 // Processes the "stop" command to stop the search. Written by Jim Ablett.
@@ -457,11 +438,14 @@ void process_stop() {
 void process_uci() {
     std::cout << "id name " << ENGINE_NAME << std::endl;
     std::cout << "id author " << ENGINE_AUTHOR << std::endl;
-    std::cout << "option name Threads type spin default 4 min 1 max 10" << std::endl;
+    std::cout << "option name Threads type spin default 4 min 1 max " << MAX_THREADS << std::endl;
     std::cout << "option name Depth type spin default 99 min 1 max 99" << std::endl;
-    std::cout << "option name Hash type spin default 256 min 64 max 1024" << std::endl;
+    std::cout << "option name Hash type spin default 256 min 1 max " << MAX_HASH << std::endl;
     std::cout << "option name UCI_Chess960 type check default false" << std::endl;
     std::cout << "option name Internal_Opening_Book type check default true" << std::endl;
+    std::cout << "option name EvalFile type string default <internal>" << std::endl;
+    std::cout << "option name SyzygyPath type string default <empty>" << std::endl;
+    std::cout << "option name SyzygyProbeDepth type spin default 1 min 0 max 100" << std::endl;
 
     //std::cout << "option name rfp_depth type spin default 2 min 0 max 20000" << std::endl;
     //std::cout << "option name rfp_c1 type spin default 200 min 0 max 20000" << std::endl;
@@ -479,11 +463,63 @@ void process_uci() {
     std::cout << "uciok" << std::endl;
 }
 
+// Parses a benchmark position given as a FEN optionally followed by "moves ...".
+Board parse_bench_position(const std::string& position, bool is_960) {
+    std::istringstream iss(position);
+    std::string base_fen;
+    std::string word;
+    std::vector<std::string> moves;
+    bool moves_section = false;
+
+    while (iss >> word) {
+        if (word == "moves") {
+            moves_section = true;
+            continue;
+        }
+
+        if (moves_section) {
+            moves.push_back(word);
+        } else {
+            if (!base_fen.empty()) base_fen += " ";
+            base_fen += word;
+        }
+    }
+
+    Board bench_board = Board(base_fen);
+    bench_board.set960(is_960);
+
+    // Apply moves if any
+    for (const auto& move_str : moves) {
+        Move move = uci::uciToMove(bench_board, move_str);
+        bench_board.makeMove(move);
+    }
+
+    return bench_board;
+}
+
+// Parses the benchmark positions into boards, skipping any that fail to parse.
+std::vector<Board> bench_boards(const std::vector<std::string>& benchmark_position, bool is_960) {
+    std::vector<Board> boards;
+    for (const auto& position : benchmark_position) {
+        try {
+            boards.push_back(parse_bench_position(position, is_960));
+        } catch (const std::exception& e) {
+            continue;
+        }
+    }
+    return boards;
+}
+
 // Performs a benchmark search on a set of positions. Mostly written by Jim Ablett.
 inline void benchmark(int bench_depth = 10, const std::vector<std::string>& benchmark_position = {}, bool chess960 = false) {
     // Written by Jim Ablett.
     auto start_time = std::chrono::high_resolution_clock::now();
     uint64_t total_nodes = 0;
+    uint64_t total_cutoffs = 0;
+    uint64_t total_first_move_cutoffs = 0;
+#ifdef ALLOC_DEBUG
+    uint64_t start_allocations = tree_allocation_count();
+#endif
     bool stop_search = false;
     search_stopped = false;
     search_running = false;
@@ -495,38 +531,7 @@ inline void benchmark(int bench_depth = 10, const std::vector<std::string>& benc
         Board bench_board;
         
         try {
-            std::string fen_string(benchmark_position[i]);
-            
-            // Handle positions with moves
-            std::istringstream iss(fen_string);
-            std::string base_fen;
-            std::string word;
-            std::vector<std::string> moves;
-            bool moves_section = false;
-            
-            while (iss >> word) {
-                if (word == "moves") {
-                    moves_section = true;
-                    continue;
-                }
-                
-                if (moves_section) {
-                    moves.push_back(word);
-                } else {
-                    if (!base_fen.empty()) base_fen += " ";
-                    base_fen += word;
-                }
-            }
-            
-            bench_board = Board(base_fen);
-            bench_board.set960(chess960);
-            
-            // Apply moves if any
-            for (const auto& move_str : moves) {
-                Move move = uci::uciToMove(bench_board, move_str);
-                bench_board.makeMove(move);
-            }
-            
+            bench_board = parse_bench_position(benchmark_position[i], chess960);
         } catch (const std::exception& e) {
             std::cout << "Bad FEN at position " << (i + 1) << ": " << benchmark_position[i] << std::endl;
             continue;
@@ -554,6 +559,9 @@ inline void benchmark(int bench_depth = 10, const std::vector<std::string>& benc
             
             // Get the actual node count from search (now properly updated by lazysmp_root_search)
             position_nodes = benchmark_nodes.load();
+            auto [position_cutoffs, position_first_move_cutoffs] = cutoff_stats();
+            total_cutoffs += position_cutoffs;
+            total_first_move_cutoffs += position_first_move_cutoffs;
             
             // Ensure we have at least some nodes counted
             if (position_nodes == 0) {
@@ -599,9 +607,123 @@ inline void benchmark(int bench_depth = 10, const std::vector<std::string>& benc
     std::cout << "Total time: " << total_duration << " ms" << std::endl;
     std::cout << "Nodes searched: " << total_nodes << std::endl;
     std::cout << "Nodes/second: " << nps << std::endl;
+    std::cout << "First-move cutoffs: "
+              << (total_cutoffs > 0 ? 100.0 * total_first_move_cutoffs / total_cutoffs : 0.0) << "%" << std::endl;
+#ifdef ALLOC_DEBUG
+    std::cout << "Heap allocations in search tree: " << tree_allocation_count() - start_allocations << std::endl;
+#endif
+    std::cout << "==========================" << std::endl;
+}
+
+// Measures lazy SMP scaling. Every position is searched for a fixed time with 1, 2, 4, ... up to max_threads
+// threads and the aggregate nodes per second is reported relative to the single-thread run.
+void smp_benchmark(int max_threads, int time_limit, const std::vector<std::string>& benchmark_position, bool is_960 = false) {
+    search_stopped = false;
+    stop_requested = false;
+
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::cout << "Starting SMP benchmark with " << time_limit << " ms per position" << std::endl;
+
+    double base_nps = 0;
+    std::vector<std::pair<int, uint64_t>> results;
+
+    for (int threads : thread_counts) {
+        uint64_t total_nodes = 0;
+        uint64_t total_duration = 0;
+
+        for (const auto& position : benchmark_position) {
+            Board bench_board;
+            try {
+                bench_board = parse_bench_position(position, is_960);
+            } catch (const std::exception& e) {
+                continue;
+            }
+
+            reset_data();
+            clear_table(threads);
+            benchmark_nodes.store(0);
+            auto pos_start = std::chrono::high_resolution_clock::now();
+            lazysmp_root_search(bench_board, threads, 99, time_limit);
+            auto pos_end = std::chrono::high_resolution_clock::now();
+
+            total_nodes += benchmark_nodes.load();
+            total_duration += std::chrono::duration_cast<std::chrono::milliseconds>(pos_end - pos_start).count();
+        }
+
+        if (total_duration == 0) total_duration = 1;
+        uint64_t nps = total_nodes * 1000ULL / total_duration;
+        if (threads == 1) base_nps = static_cast<double>(nps);
+        results.push_back({threads, nps});
+    }
+
+    std::cout << "==========================" << std::endl;
+    for (const auto& [threads, nps] : results) {
+        double speedup = base_nps > 0 ? nps / base_nps : 0.0;
+        std::cout << "Threads " << threads << ": " << nps << " nps, speedup " << speedup << "x" << std::endl;
+    }
     std::cout << "==========================" << std::endl;
 }
 
+// Runs setup and then the timed step, which ends once bestmove is printed, once per iteration on the benchmark
+// positions with the book disabled, and prints the average, min and max time of the timed step.
+void round_trip_benchmark(int iterations, const std::vector<std::string>& benchmark_position, bool is_960,
+                          const std::string& title, const std::string& label,
+                          const std::function<void()>& setup, const std::function<void()>& timed) {
+    bool use_book = internal_opening;
+    internal_opening = false;
+
+    std::vector<double> latencies;
+    for (int i = 0; i < iterations; i++) {
+        board = parse_bench_position(benchmark_position[i % benchmark_position.size()], is_960);
+        setup();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        timed();
+        wait_search();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0);
+    }
+
+    internal_opening = use_book;
+    board = Board();
+    board.set960(is_960);
+
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+
+    std::cout << "==========================" << std::endl;
+    std::cout << title << " with " << num_threads << " threads" << std::endl;
+    std::cout << "Average " << label << ": " << total / latencies.size() << " ms" << std::endl;
+    std::cout << "Min " << label << ": " << *std::min_element(latencies.begin(), latencies.end()) << " ms" << std::endl;
+    std::cout << "Max " << label << ": " << *std::max_element(latencies.begin(), latencies.end()) << " ms" << std::endl;
+    std::cout << "==========================" << std::endl;
+}
+
+// Measures the round-trip latency of "go movetime <x>", from the go command to bestmove.
+void latency_benchmark(int iterations, int movetime, const std::vector<std::string>& benchmark_position, bool is_960 = false) {
+    round_trip_benchmark(iterations, benchmark_position, is_960, "go movetime " + std::to_string(movetime), "round-trip",
+        [] {},
+        [movetime] { process_go({"go", "movetime", std::to_string(movetime)}); });
+}
+
+// Measures how fast a running search reacts to "stop", from the stop command to bestmove.
+// Each search runs without a time limit for delay ms before it is stopped.
+void stop_benchmark(int iterations, int delay, const std::vector<std::string>& benchmark_position, bool is_960 = false) {
+    round_trip_benchmark(iterations, benchmark_position, is_960, "stop after " + std::to_string(delay) + " ms", "stop latency",
+        [delay] {
+            process_go({"go", "depth", "99"});
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        },
+        [] { process_stop(); });
+}
 
 // Main UCI loop to process commands from the GUI.
 void uci_loop() {
@@ -613,35 +735,22 @@ void uci_loop() {
         } else if (line == "isready") {
             std::cout << "readyok" << std::endl;
         } else if (line == "ucinewgame") {
+            wait_search(); // Workers of a stopped search may still update the history tables
             reset_data();
+            clear_table(num_threads);
             board = Board(); // Reset board to starting position
             board.set960(chess960); // Set chess960 option
         } else if (line.find("position") == 0) {
             process_position(line);
         } else if (line.find("setoption") == 0) {
             //std::cout << "set option being processed" << std::endl;
-            std::vector<std::string> tokens;
-            std::istringstream iss(line);
-            std::string token;
-            while (iss >> token) {
-                tokens.push_back(token);
-            }
+            std::vector<std::string> tokens = split_args(line);
             process_option(tokens);
         } else if (line.find("go") == 0) {
-            std::vector<std::string> tokens;
-            std::istringstream iss(line);
-            std::string token;
-            while (iss >> token) {
-                tokens.push_back(token);
-            }
+            std::vector<std::string> tokens = split_args(line);
             process_go(tokens);
         } else if (line.find("bench") == 0) {
-            std::vector<std::string> tokens;
-            std::istringstream iss(line);
-            std::string token;
-            while (iss >> token) {
-                tokens.push_back(token);
-            }
+            std::vector<std::string> tokens = split_args(line);
             
             int bench_depth = 10; // default depth
             if (tokens.size() > 1) {
@@ -652,6 +761,94 @@ void uci_loop() {
                 }
             }
             benchmark(bench_depth, benchmark_positions, chess960);
+        } else if (line.find("latencybench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // latencybench [iterations] [movetime]
+            int iterations = 100;
+            int movetime = 10;
+            try {
+                if (tokens.size() > 1) iterations = std::stoi(tokens[1]);
+                if (tokens.size() > 2) movetime = std::stoi(tokens[2]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+            latency_benchmark(std::max(1, iterations), movetime, benchmark_positions, chess960);
+        } else if (line.find("stopbench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // stopbench [iterations] [delay]
+            int iterations = 20;
+            int delay = 100;
+            try {
+                if (tokens.size() > 1) iterations = std::stoi(tokens[1]);
+                if (tokens.size() > 2) delay = std::stoi(tokens[2]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+            stop_benchmark(std::max(1, iterations), std::max(0, delay), benchmark_positions, chess960);
+        } else if (line.find("smpbench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // smpbench [max_threads] [movetime]
+            int max_threads = num_threads;
+            int time_limit = 1000;
+            try {
+                if (tokens.size() > 1) max_threads = std::stoi(tokens[1]);
+                if (tokens.size() > 2) time_limit = std::stoi(tokens[2]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+            max_threads = std::clamp(max_threads, 1, MAX_THREADS);
+            smp_benchmark(max_threads, time_limit, benchmark_positions, chess960);
+        } else if (line.find("nnuebench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // nnuebench [iterations]
+            int iterations = 100000;
+            try {
+                if (tokens.size() > 1) iterations = std::stoi(tokens[1]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+
+            nnue_benchmark(bench_boards(benchmark_positions, chess960), std::max(1, iterations));
+#ifdef COUNTER_BENCH
+        } else if (line.find("counterbench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // counterbench [depth]: bench with the Misra-Gries move pair counters, then with continuation history
+            int bench_depth = 10;
+            try {
+                if (tokens.size() > 1) bench_depth = std::stoi(tokens[1]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+
+            for (bool misra_gries : {true, false}) {
+                std::cout << (misra_gries ? "Misra-Gries counters" : "Continuation history") << std::endl;
+                use_misra_gries_counters(misra_gries);
+                reset_data();
+                benchmark(bench_depth, benchmark_positions, chess960);
+            }
+#endif
+        } else if (line.find("perftbench") == 0) {
+            std::vector<std::string> tokens = split_args(line);
+
+            // perftbench [depth]
+            int perft_depth = 3;
+            try {
+                if (tokens.size() > 1) perft_depth = std::stoi(tokens[1]);
+            } catch (const std::exception& e) {
+                std::cout << "Invalid parameters, using defaults" << std::endl;
+            }
+
+            perft_benchmark(bench_boards(benchmark_positions, chess960), std::max(1, perft_depth));
+        } else if (line == "seetest") {
+            see_test(bench_boards(benchmark_positions, chess960));
+        } else if (line == "tbstats") {
+            auto [hits, misses] = wdl_cache_stats();
+            syzygy::print_wdl_cache_stats(hits, misses);
         } else if (line == "stop") {
             process_stop();
         } else if (line == "quit") {
@@ -661,16 +858,19 @@ void uci_loop() {
 }
 
 int main() {
-    extract_files();
-    std::string nnue_path = get_exec_path() + "/nnue/nnue_weights.bin";
-
-    if (!initialize_nnue(nnue_path)) {
+    if (!initialize_embedded_nnue(nnueWeightFile.data, nnueWeightFile.size)) {
         return 1; // Exit if NNUE initialization fails
     }
     
-    std::string eg_table_path = get_exec_path() + "/tables/";
-    syzygy::initialize_syzygy(eg_table_path);
+    register_embedded_tables();
+    syzygy::initialize_syzygy(syzygy_path);
+    set_num_threads(num_threads);
+    resize_table(hash_size, num_threads);
 
     uci_loop();
+
+    // Let a running search finish before the engine state is torn down
+    search_stopped = true;
+    wait_search();
     return 0;
 }
\ No newline at end of file
@@ -2337,6 +2337,81 @@ class Board {
      * @return
      */
     [[nodiscard]] U64 hash() const { return key_; }
+
+    /**
+     * @brief Get the zobrist hash key after the move is made, without making it. Castling rights,
+     * new en passant squares and castling moves are not accounted for, so this is meant for
+     * prefetching rather than for identifying positions.
+     * @param move
+     * @return
+     */
+    [[nodiscard]] U64 hashAfter(const Move move) const {
+        U64 key = key_ ^ Zobrist::sideToMove();
+
+        if (ep_sq_ != Square::underlying::NO_SQ) key ^= Zobrist::enpassant(ep_sq_.file());
+
+        const auto piece    = at(move.from());
+        const auto captured = at(move.to());
+
+        if (captured != Piece::NONE && move.typeOf() != Move::CASTLING) key ^= Zobrist::piece(captured, move.to());
+
+        const auto placed = move.typeOf() == Move::PROMOTION ? Piece(move.promotionType(), stm_) : piece;
+        return key ^ Zobrist::piece(piece, move.from()) ^ Zobrist::piece(placed, move.to());
+    }
+
+    /**
+     * @brief Reserve room for the undo states of n more moves, so that making them does not allocate.
+     * A copied board only has room for its current history.
+     * @param n
+     */
+    void reserveMoves(std::size_t n) { prev_states_.reserve(prev_states_.size() + n); }
+
+    /**
+     * @brief Checks if a legal move gives check, without making it. Covers direct checks, discovered checks
+     * (including those uncovered by an en passant capture), checks by the promoted piece and checks by the
+     * rook after castling.
+     * @param move
+     * @return
+     */
+    [[nodiscard]] bool givesCheck(const Move move) const {
+        const auto ksq     = kingSq(~stm_);
+        const auto king_bb = Bitboard::fromSquare(ksq.index());
+        const auto from_bb = Bitboard::fromSquare(move.from().index());
+        const auto to_bb   = Bitboard::fromSquare(move.to().index());
+
+        if (move.typeOf() == Move::CASTLING) {
+            const bool king_side = move.to() > move.from();
+            const auto rook_to   = Square::castling_rook_square(king_side, stm_);
+            const auto king_to   = Square::castling_king_square(king_side, stm_);
+            const auto occ       = ((occ_bb_[0] | occ_bb_[1]) ^ from_bb ^ to_bb) |
+                             Bitboard::fromSquare(rook_to.index()) | Bitboard::fromSquare(king_to.index());
+
+            return static_cast<bool>(attacks::rook(rook_to, occ) & king_bb);
+        }
+
+        auto occ = ((occ_bb_[0] | occ_bb_[1]) ^ from_bb) | to_bb;
+        if (move.typeOf() == Move::ENPASSANT) occ ^= Bitboard::fromSquare(move.to().ep_square().index());
+
+        const auto pt = move.typeOf() == Move::PROMOTION ? move.promotionType() : at<PieceType>(move.from());
+
+        // Direct check by the moved piece
+        Bitboard direct = 0;
+        if (pt == PieceType::PAWN) direct = attacks::pawn(stm_, move.to());
+        else if (pt == PieceType::KNIGHT) direct = attacks::knight(move.to());
+        else if (pt == PieceType::BISHOP) direct = attacks::bishop(move.to(), occ);
+        else if (pt == PieceType::ROOK) direct = attacks::rook(move.to(), occ);
+        else if (pt == PieceType::QUEEN) direct = attacks::queen(move.to(), occ);
+
+        if (direct & king_bb) return true;
+
+        // Discovered check by a slider behind the vacated square
+        const auto queens  = pieces(PieceType::QUEEN, stm_);
+        const auto bishops = (pieces(PieceType::BISHOP, stm_) | queens) & ~from_bb;
+        const auto rooks   = (pieces(PieceType::ROOK, stm_) | queens) & ~from_bb;
+
+        return static_cast<bool>((attacks::bishop(ksq, occ) & bishops) | (attacks::rook(ksq, occ) & rooks));
+    }
+
     [[nodiscard]] Color sideToMove() const { return stm_; }
     [[nodiscard]] Square enpassantSq() const { return ep_sq_; }
     [[nodiscard]] CastlingRights castlingRights() const { return cr_; }
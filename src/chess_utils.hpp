@@ -45,10 +45,13 @@ inline bool is_castling(const Move& move);
 inline bool is_promotion(const Move& move);
 inline bool is_mopup(Board& board);
 inline int mopup_score(const Board& board);
-inline void update_pv(std::vector<Move>& PV, const Move& move, const std::vector<Move>& childPV);
 inline bool promotion_threat(Board& board, Move move);
 inline bool non_pawn_material(Board& board);
 inline int piece_type_value(PieceType pt);
+inline int see(const Board& board, Move move);
+inline bool see_ge(const Board& board, Move move, int threshold);
+inline bool is_draw(const Board& board);
+inline bool has_legal_move(const Board& board);
 
 // Function definitions
 inline void eval_adjust(int& eval) {
@@ -63,12 +66,6 @@ inline void eval_adjust(int& eval) {
     }
 }
 
-inline void update_pv(std::vector<Move>& PV, const Move& move, const std::vector<Move>& childPV) {
-    PV.clear();
-    PV.push_back(move);
-    PV.insert(PV.end(), childPV.begin(), childPV.end());
-}
-
 inline int game_phase (const Board& board) {
     return board.pieces(PieceType::KNIGHT).count() +
             board.pieces(PieceType::BISHOP).count() +
@@ -282,3 +279,225 @@ inline int piece_type_value(PieceType pt) {
     return table[static_cast<int>(pt)];
 }
 
+// All pieces attacking sq for the given occupancy
+inline Bitboard see_attackers(const Board& board, Square sq, Bitboard occ) {
+    Bitboard bishops = board.pieces(PieceType::BISHOP) | board.pieces(PieceType::QUEEN);
+    Bitboard rooks = board.pieces(PieceType::ROOK) | board.pieces(PieceType::QUEEN);
+
+    return (attacks::pawn(Color::WHITE, sq) & board.pieces(PieceType::PAWN, Color::BLACK))
+        | (attacks::pawn(Color::BLACK, sq) & board.pieces(PieceType::PAWN, Color::WHITE))
+        | (attacks::knight(sq) & board.pieces(PieceType::KNIGHT))
+        | (attacks::bishop(sq, occ) & bishops)
+        | (attacks::rook(sq, occ) & rooks)
+        | (attacks::king(sq) & board.pieces(PieceType::KING));
+}
+
+// Pieces of color that are pinned to their king along a line that does not contain sq, and the pieces pinning
+// them. Pins are found on the occupancy after the first capture, so that pins made or broken by the capturing
+// piece are seen.
+inline Bitboard see_pinned(const Board& board, Color color, Square sq, Bitboard occ, Bitboard& pinners) {
+    Square king = board.kingSq(color);
+    Bitboard king_bb = Bitboard::fromSquare(king.index());
+    Bitboard target_bb = Bitboard::fromSquare(sq.index());
+    Bitboard us = board.us(color) & occ;
+    Bitboard them = board.us(~color) & occ;
+    Bitboard their_queens = board.pieces(PieceType::QUEEN, ~color) & occ;
+    Bitboard pinned = 0;
+    pinners = 0;
+
+    // Our pieces are transparent here, so a slider that sees the king through exactly one of them pins it
+    Bitboard rook_snipers = attacks::rook(king, them) & (board.pieces(PieceType::ROOK, ~color) | their_queens) & occ;
+    while (rook_snipers) {
+        Square sniper = rook_snipers.pop();
+        Bitboard ray = (attacks::rook(king, Bitboard::fromSquare(sniper.index())) & attacks::rook(sniper, king_bb))
+            | Bitboard::fromSquare(sniper.index());
+        if ((ray & us).count() == 1 && !(ray & target_bb)) {
+            pinned |= ray & us;
+            pinners |= Bitboard::fromSquare(sniper.index());
+        }
+    }
+
+    Bitboard bishop_snipers = attacks::bishop(king, them) & (board.pieces(PieceType::BISHOP, ~color) | their_queens) & occ;
+    while (bishop_snipers) {
+        Square sniper = bishop_snipers.pop();
+        Bitboard ray = (attacks::bishop(king, Bitboard::fromSquare(sniper.index())) & attacks::bishop(sniper, king_bb))
+            | Bitboard::fromSquare(sniper.index());
+        if ((ray & us).count() == 1 && !(ray & target_bb)) {
+            pinned |= ray & us;
+            pinners |= Bitboard::fromSquare(sniper.index());
+        }
+    }
+
+    return pinned;
+}
+
+// Least valuable piece in attackers. Returns PieceType::NONE if there is none.
+inline PieceType see_least_valuable(const Board& board, Bitboard attackers, Bitboard& piece) {
+    for (PieceType pt : {PieceType::PAWN, PieceType::KNIGHT, PieceType::BISHOP,
+                         PieceType::ROOK, PieceType::QUEEN, PieceType::KING}) {
+        Bitboard candidates = attackers & board.pieces(pt);
+        if (candidates) {
+            piece = Bitboard::fromSquare(candidates.lsb());
+            return pt;
+        }
+    }
+    return PieceType::NONE;
+}
+
+// Material won by move if both sides keep capturing on its target square while it pays off, from a swap list
+// built on bitboards. Attackers of the target square capture least valuable first, sliders behind them join as
+// the occupancy clears (x-rays), and the king only recaptures on an undefended square. Pieces pinned to their own
+// king after the first capture may only capture along the pin while the pinner is on the board. Pins that appear
+// later and checks given during the exchange are ignored, and recaptures that promote are valued as plain pawn
+// captures.
+inline int see(const Board& board, Move move) {
+    if (move.typeOf() == Move::CASTLING) {
+        return 0;
+    }
+
+    Square from = move.from();
+    Square to = move.to();
+    Bitboard occ = board.occ() ^ Bitboard::fromSquare(from.index());
+    PieceType attacker = board.at<PieceType>(from);
+    int gain[40];
+    int d = 0;
+
+    if (move.typeOf() == Move::ENPASSANT) {
+        gain[0] = PAWN_VALUE;
+        occ ^= Bitboard::fromSquare(to.ep_square().index());
+    } else {
+        gain[0] = piece_type_value(board.at<PieceType>(to));
+    }
+
+    if (move.typeOf() == Move::PROMOTION) {
+        gain[0] += piece_type_value(move.promotionType()) - PAWN_VALUE;
+        attacker = move.promotionType();
+    }
+
+    Bitboard bishops = board.pieces(PieceType::BISHOP) | board.pieces(PieceType::QUEEN);
+    Bitboard rooks = board.pieces(PieceType::ROOK) | board.pieces(PieceType::QUEEN);
+    Bitboard attackers = see_attackers(board, to, occ) & occ;
+    Bitboard pinners[2];
+    Bitboard pinned[2] = {see_pinned(board, Color::WHITE, to, occ, pinners[0]),
+                          see_pinned(board, Color::BLACK, to, occ, pinners[1])};
+    Color side = ~board.sideToMove();
+
+    while (true) {
+        // Speculative gain of side if it recaptures the piece on the target square
+        d++;
+        gain[d] = piece_type_value(attacker) - gain[d - 1];
+
+        // Pinned pieces stay out of the exchange while one of their pinners is on the board
+        int c = side == Color::WHITE ? 0 : 1;
+        Bitboard blocked = (pinners[c] & occ) ? pinned[c] : Bitboard(0);
+
+        Bitboard piece;
+        PieceType pt = see_least_valuable(board, attackers & board.us(side) & ~blocked, piece);
+        if (pt == PieceType::NONE) break;
+        if (pt == PieceType::KING && (attackers & board.us(~side))) break;
+
+        occ ^= piece;
+        attackers = (attackers | (attacks::bishop(to, occ) & bishops) | (attacks::rook(to, occ) & rooks)) & occ;
+        attacker = pt;
+        side = ~side;
+    }
+
+    while (--d) {
+        gain[d - 1] = -std::max(-gain[d - 1], gain[d]);
+    }
+    return gain[0];
+}
+
+// Whether see(board, move) >= threshold, without building the whole swap list
+inline bool see_ge(const Board& board, Move move, int threshold) {
+    if (move.typeOf() == Move::CASTLING) {
+        return 0 >= threshold;
+    }
+
+    Square from = move.from();
+    Square to = move.to();
+    Bitboard occ = board.occ() ^ Bitboard::fromSquare(from.index());
+    PieceType attacker = board.at<PieceType>(from);
+    int swap;
+
+    if (move.typeOf() == Move::ENPASSANT) {
+        swap = PAWN_VALUE;
+        occ ^= Bitboard::fromSquare(to.ep_square().index());
+    } else {
+        swap = piece_type_value(board.at<PieceType>(to));
+    }
+
+    if (move.typeOf() == Move::PROMOTION) {
+        swap += piece_type_value(move.promotionType()) - PAWN_VALUE;
+        attacker = move.promotionType();
+    }
+
+    // Even winning the target for free does not reach the threshold
+    swap -= threshold;
+    if (swap < 0) return false;
+
+    // Even losing the moved piece keeps us above the threshold
+    swap = piece_type_value(attacker) - swap;
+    if (swap <= 0) return true;
+
+    Bitboard bishops = board.pieces(PieceType::BISHOP) | board.pieces(PieceType::QUEEN);
+    Bitboard rooks = board.pieces(PieceType::ROOK) | board.pieces(PieceType::QUEEN);
+    Bitboard attackers = see_attackers(board, to, occ) & occ;
+    Bitboard pinners[2];
+    Bitboard pinned[2] = {see_pinned(board, Color::WHITE, to, occ, pinners[0]),
+                          see_pinned(board, Color::BLACK, to, occ, pinners[1])};
+    Color side = board.sideToMove();
+    int result = 1;
+
+    while (true) {
+        side = ~side;
+        attackers &= occ;
+
+        // Pinned pieces stay out of the exchange while one of their pinners is on the board
+        int c = side == Color::WHITE ? 0 : 1;
+        Bitboard blocked = (pinners[c] & occ) ? pinned[c] : Bitboard(0);
+
+        Bitboard piece;
+        PieceType pt = see_least_valuable(board, attackers & board.us(side) & ~blocked, piece);
+        if (pt == PieceType::NONE) break;
+
+        // side captures, so the result flips unless the next capture turns it back
+        result ^= 1;
+
+        if (pt == PieceType::KING) {
+            return (attackers & board.us(~side)) ? !result : result;
+        }
+
+        swap = piece_type_value(pt) - swap;
+        if (swap < result) break;
+
+        occ ^= piece;
+        attackers |= (attacks::bishop(to, occ) & bishops) | (attacks::rook(to, occ) & rooks);
+    }
+
+    return result;
+}
+
+// Draws that are found without generating moves: the fifty-move rule, insufficient material and any repetition
+// since the last irreversible move (Board::isRepetition only scans that window of the position history).
+// Checkmate and stalemate are left to the search, which sees them when a node has no legal move.
+inline bool is_draw(const Board& board) {
+    if (board.isHalfMoveDraw()) {
+        // Mate on the move that reaches the limit takes precedence. Rare enough to generate the moves here.
+        return board.getHalfMoveDrawType().first != GameResultReason::CHECKMATE;
+    }
+    return board.isInsufficientMaterial() || board.isRepetition(1);
+}
+
+// Whether the side to move has any legal move, to tell stalemate from a quiet position before a node is cut off
+// without its move list. King moves are generated first since the king almost always has one.
+inline bool has_legal_move(const Board& board) {
+    Movelist moves;
+    movegen::legalmoves(moves, board, PieceGenType::KING);
+    if (!moves.empty()) {
+        return true;
+    }
+    movegen::legalmoves(moves, board, PieceGenType::PAWN | PieceGenType::KNIGHT | PieceGenType::BISHOP |
+                                      PieceGenType::ROOK | PieceGenType::QUEEN);
+    return !moves.empty();
+}
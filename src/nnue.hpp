@@ -4,29 +4,49 @@
 #include <array>
 #include <fstream>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <new>
 #include "chess.hpp"
+#include "nnue_simd.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
 
 using namespace chess;
 
 constexpr int INPUT_SIZE = 768;
-constexpr int HIDDEN_SIZE = 1024;
+constexpr int MAX_HIDDEN_SIZE = 1024;
 constexpr int SCALE = 400;
 constexpr int QA = 255;
 constexpr int QB = 64;
+constexpr int MAX_UPDATE_FEATURES = 32; // Most features added or removed by one Accumulator::update
+constexpr int ACCUMULATOR_STACK_SIZE = 256; // Maximum number of moves made from the root
+constexpr char NETWORK_MAGIC[4] = {'A', 'K', 'U', 'N'};
+constexpr uint32_t NETWORK_VERSION = 1;
 
 // Function Declarations
 struct Accumulator;
+struct AccumulatorPair;
+struct AccumulatorStack;
+struct RefreshCache;
 struct Network;
 inline int calculate_index(int side, int pieceType, int square);
 inline int piecetype_to_idx(PieceType type);
+inline PieceType idx_to_piecetype(int piece_idx);
 inline int crelu(int16_t x);
 inline int screlu(int16_t x);
 inline int mirror_sq(int sq);
+bool parse_network(const char* data, size_t size, std::shared_ptr<const void> memory, Network& net);
 bool load_network(const std::string& filepath, Network& net);
+bool load_embedded_network(const unsigned char* data, size_t size, Network& net);
 void make_accumulators(Board& board, Accumulator& white_accumulator, Accumulator& black_accumulator, Network& eval_network);
-void add_accumulators(Board& board, Move& move, Accumulator& white_accumulator, Accumulator& black_accumulator, Network& eval_network);
-void subtract_accumulators(Board& board, Move& move, Accumulator& white_accumulator, Accumulator& black_accumulator, Network& eval_network);
+inline int feature_index(Color perspective, Color color, int piece_idx, int square);
 
 // Function Definitions
 
@@ -49,6 +69,13 @@ inline int piecetype_to_idx(PieceType type) {
     return -1; // Invalid piece type
 }
 
+// Piece index to PieceType
+inline PieceType idx_to_piecetype(int piece_idx) {
+    static const PieceType types[6] = {PieceType::PAWN, PieceType::KNIGHT, PieceType::BISHOP,
+                                       PieceType::ROOK, PieceType::QUEEN, PieceType::KING};
+    return types[piece_idx];
+}
+
 // Clip ReLU
 inline int crelu(int16_t x) {
     int val = static_cast<int>(x);
@@ -61,36 +88,56 @@ inline int screlu(int16_t x) {
     return val * val;
 }
 
-// Accumulator
+// Accumulator. Sized for the largest supported network; only the first hidden_size values are used.
 struct Accumulator {
-    alignas(32) std::array<int16_t, HIDDEN_SIZE> vals;
+    alignas(64) std::array<int16_t, MAX_HIDDEN_SIZE> vals;
     static Accumulator from_bias(const Network& net);
-    void add_feature(size_t feature_idx, const Network& net);
-    void remove_feature(size_t feature_idx, const Network& net);
+    void update(const Accumulator& src, const int* adds, int num_adds, const int* subs, int num_subs, const Network& net);
 };
 
-// (768 -> HIDDEN_SIZE) x 2 -> 1
+// Optional header of a weight file. Files without it are plain bullet output and their hidden size is
+// inferred from the file size. The header is 64 bytes so that the weights after it stay cache-line aligned.
+struct NetworkHeader {
+    char magic[4];        // NETWORK_MAGIC
+    uint32_t version;     // NETWORK_VERSION
+    uint32_t hidden_size;
+    char reserved[52];
+};
+
+static_assert(sizeof(NetworkHeader) == 64);
+
+// (768 -> hidden_size) x 2 -> 1
 // Network architecture:
 // x1 : 768 for side-to-move
 // x2 : 768 for not-side-to-move
 // h1 = Wx1 + b  
 // h2 = Wx2 + b
 // o = O1 * relu(h1) + O2 * relu(h2) + c
+//
+// The weights are read in place from memory owned by the network. The hidden layer size is chosen when the
+// network is loaded, together with kernels compiled for that size.
 struct Network {
-    alignas(32) std::array<Accumulator, 768> feature_weights;
-    Accumulator feature_bias;
-    std::array<int16_t, 2 * HIDDEN_SIZE> output_weights;
-    int16_t output_bias;
+    int hidden_size = 0;
+    const int16_t* feature_weights = nullptr; // INPUT_SIZE rows of hidden_size
+    const int16_t* feature_bias = nullptr;    // hidden_size
+    const int16_t* output_weights = nullptr;  // 2 x hidden_size
+    int16_t output_bias = 0;
+    bool madd_safe = true; // All output weights are small enough for the vector SCReLU kernels
+    NnueKernels kernels;
+    std::shared_ptr<const void> memory; // Keeps the weights alive
+
+    const int16_t* feature_row(int feature_idx) const {
+        return feature_weights + static_cast<size_t>(feature_idx) * hidden_size;
+    }
+
+    // Use the kernels of the given instruction set, or scalar ones if the weights are too large for them
+    void select_kernels(SimdIsa isa) {
+        kernels = make_nnue_kernels(madd_safe ? isa : SimdIsa::SCALAR, hidden_size);
+    }
 
     int evaluate(const Accumulator& us, const Accumulator& them) const {
-        int output = 0;
-    
-        #pragma omp simd reduction(+:output)
-        for (int i = 0; i < HIDDEN_SIZE; ++i) {
-            output += screlu(us.vals[i]) * static_cast<int>(output_weights[i]) +
-                      screlu(them.vals[i]) * static_cast<int>(output_weights[HIDDEN_SIZE + i]);
-        }
-    
+        int output = kernels.screlu_dot(us.vals.data(), them.vals.data(), output_weights);
+
         output /= QA;
         output += static_cast<int>(output_bias);
 
@@ -103,55 +150,147 @@ struct Network {
 
 // Accumulator functions
 inline Accumulator Accumulator::from_bias(const Network& net) {
-    return net.feature_bias;
+    Accumulator acc;
+    std::copy(net.feature_bias, net.feature_bias + net.hidden_size, acc.vals.begin());
+    return acc;
 }
 
-inline void Accumulator::add_feature(size_t feature_idx, const Network& net) {
-    #pragma omp simd
-    for (size_t i = 0; i < HIDDEN_SIZE; ++i) {
-        vals[i] += net.feature_weights[feature_idx].vals[i];
-    }
+// this = src + sum(w[adds]) - sum(w[subs]) in a single pass over the hidden layer.
+// src may be this accumulator.
+inline void Accumulator::update(const Accumulator& src,
+                                const int* adds, int num_adds,
+                                const int* subs, int num_subs,
+                                const Network& net) {
+    const int16_t* add_rows[MAX_UPDATE_FEATURES] = {};
+    const int16_t* sub_rows[MAX_UPDATE_FEATURES] = {};
+
+    for (int i = 0; i < num_adds; i++) add_rows[i] = net.feature_row(adds[i]);
+    for (int i = 0; i < num_subs; i++) sub_rows[i] = net.feature_row(subs[i]);
+
+    net.kernels.add_sub(vals.data(), src.vals.data(), add_rows, num_adds, sub_rows, num_subs);
 }
 
-inline void Accumulator::remove_feature(size_t feature_idx, const Network& net) {
-    #pragma omp simd
-    for (size_t i = 0; i < HIDDEN_SIZE; ++i) {
-        vals[i] -= net.feature_weights[feature_idx].vals[i];
+// Number of bytes of network parameters for a hidden layer size
+inline size_t network_bytes(int hidden_size) {
+    return (static_cast<size_t>(INPUT_SIZE + 3) * hidden_size + 1) * sizeof(int16_t);
+}
+
+// Set up a network over weights in memory. data must stay valid while the network is used,
+// which the caller guarantees by passing its owner as memory.
+bool parse_network(const char* data, size_t size, std::shared_ptr<const void> memory, Network& net) {
+    int hidden_size = 0;
+    NetworkHeader header;
+
+    if (size >= sizeof(header)) {
+        std::memcpy(&header, data, sizeof(header));
+    }
+
+    if (size >= sizeof(header) && std::memcmp(header.magic, NETWORK_MAGIC, 4) == 0) {
+        if (header.version != NETWORK_VERSION) {
+            std::cerr << "Unsupported network version " << header.version << std::endl;
+            return false;
+        }
+        hidden_size = static_cast<int>(header.hidden_size);
+        data += sizeof(header);
+        size -= sizeof(header);
+    } else {
+        // Headerless file. Bullet pads the parameters to a multiple of 64 bytes.
+        for (int candidate : SUPPORTED_HIDDEN_SIZES) {
+            size_t bytes = network_bytes(candidate);
+            if (size >= bytes && size < bytes + 64) {
+                hidden_size = candidate;
+            }
+        }
     }
+
+    if (!hidden_size_supported(hidden_size) || size < network_bytes(hidden_size)) {
+        std::cerr << "Unrecognized network layout (" << size << " bytes, hidden size " << hidden_size << ")" << std::endl;
+        return false;
+    }
+
+    const int16_t* params = reinterpret_cast<const int16_t*>(data);
+    net.hidden_size = hidden_size;
+    net.feature_weights = params;
+    net.feature_bias = net.feature_weights + static_cast<size_t>(INPUT_SIZE) * hidden_size;
+    net.output_weights = net.feature_bias + hidden_size;
+    std::memcpy(&net.output_bias, net.output_weights + 2 * hidden_size, sizeof(int16_t));
+    net.memory = std::move(memory);
+
+    // The vector SCReLU kernels need QA * |w| to fit in int16
+    net.madd_safe = true;
+    for (int i = 0; i < 2 * hidden_size; i++) {
+        if (std::abs(net.output_weights[i]) > 128) {
+            std::cerr << "Output weights too large for vector kernels, using scalar evaluation.\n";
+            net.madd_safe = false;
+            break;
+        }
+    }
+
+    net.select_kernels(nnue_isa);
+    return true;
 }
 
-// Load network from file
+// Load network from file. On POSIX systems the file is mapped read-only and shared, so every engine process
+// using the same file shares one physical copy of the weights. Elsewhere it is read into memory.
 bool load_network(const std::string& filepath, Network& net) {
-    std::ifstream stream(filepath, std::ios::binary);
-    if (!stream.is_open()) {
+#if defined(__linux__) || defined(__APPLE__)
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
         std::cerr << "Failed to open file: " << filepath << std::endl;
         return false;
     }
 
-    // Layer 1
-    for (int i = 0; i < INPUT_SIZE; ++i) {
-        stream.read(reinterpret_cast<char*>(net.feature_weights[i].vals.data()),
-                    HIDDEN_SIZE * sizeof(int16_t));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << "Failed to read full network from file.\n";
+        close(fd);
+        return false;
     }
 
-    // Load hidden layer bias: HL int16_t
-    stream.read(reinterpret_cast<char*>(net.feature_bias.vals.data()),
-                HIDDEN_SIZE * sizeof(int16_t));
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
 
-    // Load output weights: 2 x HL int16_t
-    stream.read(reinterpret_cast<char*>(net.output_weights.data()), 2 * HIDDEN_SIZE * sizeof(int16_t));
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map file: " << filepath << std::endl;
+        return false;
+    }
 
-    // Load output bias: 1 int16_t
-    stream.read(reinterpret_cast<char*>(&net.output_bias), sizeof(int16_t));
+    std::shared_ptr<const void> memory(mapped, [size](const void* p) {
+        munmap(const_cast<void*>(p), size);
+    });
 
-    if (!stream) {
+    return parse_network(static_cast<const char*>(mapped), size, std::move(memory), net);
+#else
+    std::ifstream stream(filepath, std::ios::binary | std::ios::ate);
+    if (!stream.is_open()) {
+        std::cerr << "Failed to open file: " << filepath << std::endl;
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(stream.tellg());
+    stream.seekg(0);
+
+    // Cache-line aligned buffer, so that feature rows do not straddle cache lines
+    char* buffer = new (std::align_val_t(64)) char[size];
+    std::shared_ptr<const void> memory(buffer, [](const void* p) {
+        ::operator delete[](const_cast<void*>(p), std::align_val_t(64));
+    });
+
+    if (!stream.read(buffer, size)) {
         std::cerr << "Failed to read full network from file.\n";
         return false;
     }
 
-    return true;
+    return parse_network(buffer, size, std::move(memory), net);
+#endif
 }
 
+// Use a network embedded in the executable in place. The weights are read straight from the read-only
+// data section, which the OS shares between all processes running the same executable.
+bool load_embedded_network(const unsigned char* data, size_t size, Network& net) {
+    return parse_network(reinterpret_cast<const char*>(data), size, nullptr, net);
+}
 
 // Create accumulators for white and black pieces.
 inline int mirror_sq(int sq) {
@@ -179,6 +318,10 @@ void make_accumulators(Board& board, Accumulator& white_accumulator, Accumulator
         board.pieces(PieceType::KING, Color::BLACK)
     };
 
+    int white_features[MAX_UPDATE_FEATURES];
+    int black_features[MAX_UPDATE_FEATURES];
+    int num_features = 0;
+
     for (int i = 0; i < 12; i++) {
         Bitboard bb = bitboards[i];
 
@@ -191,180 +334,232 @@ void make_accumulators(Board& board, Accumulator& white_accumulator, Accumulator
         
             if (white) {
                 // from White’s view
-                white_accumulator.add_feature(calculate_index(0, type, sq),  eval_network); // us
-                black_accumulator.add_feature(calculate_index(1, type, msq), eval_network); // them
+                white_features[num_features] = calculate_index(0, type, sq);  // us
+                black_features[num_features] = calculate_index(1, type, msq); // them
             } else {
                 // from Black’s view
-                black_accumulator.add_feature(calculate_index(0, type, msq),  eval_network); // us
-                white_accumulator.add_feature(calculate_index(1, type, sq), eval_network); // them
+                black_features[num_features] = calculate_index(0, type, msq); // us
+                white_features[num_features] = calculate_index(1, type, sq);  // them
             }
+            num_features++;
         }
         
     }
+
+    // Add all pieces in one pass over each accumulator
+    white_accumulator.update(white_accumulator, white_features, num_features, nullptr, 0, eval_network);
+    black_accumulator.update(black_accumulator, black_features, num_features, nullptr, 0, eval_network);
 }
 
-// Update accumulator given a move.
-// Work in progress: need to consider castling &  enpassant.
-// To be called before board.makeMove(move).
-void add_accumulators(Board& board, 
-                        Move& move, 
-                        Accumulator& white_accumulator, 
-                        Accumulator& black_accumulator,
-                        Network& eval_network) {
-
-    Color color = board.sideToMove();
-    PieceType piece_type = board.at<Piece>(move.from()).type();
-
-    int piece_idx = piecetype_to_idx(piece_type);
-    bool is_promotion = move.typeOf() & Move::PROMOTION;
-    bool is_enpassant = move.typeOf() & Move::ENPASSANT;
-    bool is_castling = move.typeOf() & Move::CASTLING; 
-    bool is_null_move = move.typeOf() & Move::NULL_MOVE;
-
-    if (is_null_move) {
-        return; 
+// Feature index of a piece of the given color from the given perspective.
+// Black's perspective sees the board mirrored.
+inline int feature_index(Color perspective, Color color, int piece_idx, int square) {
+    if (perspective == Color::WHITE) {
+        return calculate_index(color == Color::WHITE ? 0 : 1, piece_idx, square);
     }
+    return calculate_index(color == Color::BLACK ? 0 : 1, piece_idx, mirror_sq(square));
+}
+
+// A piece placed on or removed from a square
+struct PieceFeature {
+    Color color;
+    int piece_idx;
+    int square;
+};
+
+// Feature changes made by one move. A move adds at most two pieces and removes at most two.
+struct DirtyPieces {
+    PieceFeature adds[2];
+    PieceFeature subs[2];
+    int num_adds = 0;
+    int num_subs = 0;
 
-    if (is_promotion || is_enpassant || is_castling) {
-        // For now calculate from scratch for promotion and enpassant
-        board.makeMove(move);
-        make_accumulators(board, white_accumulator, black_accumulator, eval_network);
-        board.unmakeMove(move);
-        return;
+    void add(Color color, int piece_idx, int square) {
+        adds[num_adds++] = {color, piece_idx, square};
     }
 
-    if (color == Color::WHITE) {
-        int from_idx_us = calculate_index(0, piece_idx, move.from().index());
-        int to_idx_us = calculate_index(0, piece_idx, move.to().index());
-        int from_idx_them = calculate_index(1, piece_idx, mirror_sq(move.from().index()));
-        int to_idx_them = calculate_index(1, piece_idx, mirror_sq(move.to().index()));
+    void sub(Color color, int piece_idx, int square) {
+        subs[num_subs++] = {color, piece_idx, square};
+    }
+};
 
-        // Calculate index of from and to from "us" perspective
-        white_accumulator.remove_feature(from_idx_us, eval_network);
-        white_accumulator.add_feature(to_idx_us, eval_network);
+// Accumulators of both perspectives for one position, and the move delta from the parent position
+struct AccumulatorPair {
+    Accumulator white;
+    Accumulator black;
+    DirtyPieces dirty;
+    bool computed = false;
+};
+
+// Accumulator refresh cache ("Finny table"). Keeps the last refreshed accumulator of each perspective
+// together with the piece bitboards it was computed from. A refresh then only adds and removes the pieces
+// that differ between the cached position and the new one, instead of adding every piece to the bias.
+// One cache per search thread.
+struct RefreshCache {
+    struct Entry {
+        Accumulator accumulator;
+        uint64_t pieces[2][6]; // [color][piece_idx]
+        bool valid = false;
+    };
 
-        black_accumulator.remove_feature(from_idx_them, eval_network);
-        black_accumulator.add_feature(to_idx_them, eval_network);
+    Entry entries[2]; // [perspective]
 
-        if (board.isCapture(move)) {
-            // Remove the captured piece
-            PieceType captured = board.at<Piece>(move.to()).type();
-            int capture_idx = piecetype_to_idx(captured);
+    // Forget the cached accumulators, e.g. after loading a different network
+    void clear() {
+        entries[0].valid = false;
+        entries[1].valid = false;
+    }
 
-            // remove the black piece from white's perspective
-            int capture_index_us = calculate_index(1, capture_idx, move.to().index());
-            white_accumulator.remove_feature(capture_index_us, eval_network);
+    void refresh(Board& board, Color perspective, Accumulator& accumulator, const Network& eval_network) {
+        Entry& entry = entries[static_cast<int>(perspective)];
 
-            // remove the black piece from black's perspective
-            int capture_index_them = calculate_index(0, capture_idx, mirror_sq(move.to().index()));
-            black_accumulator.remove_feature(capture_index_them, eval_network);
+        if (!entry.valid) {
+            entry.accumulator = Accumulator::from_bias(eval_network);
+            std::memset(entry.pieces, 0, sizeof(entry.pieces));
+            entry.valid = true;
         }
 
-    } else {
-        int from_idx_us = calculate_index(0, piece_idx, mirror_sq(move.from().index()));
-        int to_idx_us = calculate_index(0, piece_idx, mirror_sq(move.to().index()));
-        int from_idx_them = calculate_index(1, piece_idx, move.from().index());
-        int to_idx_them = calculate_index(1, piece_idx, move.to().index());
+        int adds[MAX_UPDATE_FEATURES], subs[MAX_UPDATE_FEATURES];
+        int num_adds = 0, num_subs = 0;
 
-        black_accumulator.remove_feature(from_idx_us, eval_network);
-        black_accumulator.add_feature(to_idx_us, eval_network);
+        for (Color color : {Color::WHITE, Color::BLACK}) {
+            for (int piece_idx = 0; piece_idx < 6; piece_idx++) {
+                uint64_t& cached = entry.pieces[static_cast<int>(color)][piece_idx];
+                uint64_t current = board.pieces(idx_to_piecetype(piece_idx), color).getBits();
 
-        white_accumulator.remove_feature(from_idx_them, eval_network);
-        white_accumulator.add_feature(to_idx_them, eval_network);
+                for (uint64_t added = current & ~cached; added; added &= added - 1) {
+                    adds[num_adds++] = feature_index(perspective, color, piece_idx, __builtin_ctzll(added));
+                }
+                for (uint64_t removed = cached & ~current; removed; removed &= removed - 1) {
+                    subs[num_subs++] = feature_index(perspective, color, piece_idx, __builtin_ctzll(removed));
+                }
 
-        if (board.isCapture(move)) {
-            PieceType captured = board.at<Piece>(move.to()).type();
-            int capture_idx = piecetype_to_idx(captured);
+                cached = current;
+            }
+        }
 
-            // remove the white piece from black's perspective
-            int capture_index_us = calculate_index(1, capture_idx, mirror_sq(move.to().index()));
-            black_accumulator.remove_feature(capture_index_us, eval_network);
+        entry.accumulator.update(entry.accumulator, adds, num_adds, subs, num_subs, eval_network);
+        accumulator = entry.accumulator;
+    }
+};
 
-            // remove the white piece from white's perspective
-            int capture_index_them = calculate_index(0, capture_idx, move.to().index());
-            white_accumulator.remove_feature(capture_index_them, eval_network);
-        }
+// Per-thread stack of accumulators with one entry per move made from the root.
+// Making a move only records the feature changes. The accumulators are computed when the position
+// is evaluated, by walking back to the last computed entry and applying the recorded deltas from there,
+// so children cut off before evaluation (tt hits, tablebase probes, draws) cost no NNUE work.
+// Unmaking a move just drops back to the parent entry.
+struct AccumulatorStack {
+    std::array<AccumulatorPair, ACCUMULATOR_STACK_SIZE> entries;
+    int top = 0;
+    RefreshCache refresh_cache;
+
+    // Build the root entry through the refresh cache
+    void reset(Board& board, Network& eval_network) {
+        top = 0;
+        refresh_cache.refresh(board, Color::WHITE, entries[0].white, eval_network);
+        refresh_cache.refresh(board, Color::BLACK, entries[0].black, eval_network);
+        entries[0].computed = true;
     }
-}
 
-// Update accumulator given an unmakeMove.
-// To be called before board.unmakeMove(move).
-void subtract_accumulators(Board& board, 
-                                Move& move, 
-                                Accumulator& white_accumulator, 
-                                Accumulator& black_accumulator,
-                                Network& eval_network) {
-
-    bool is_promotion = move.typeOf() & Move::PROMOTION;
-    bool is_enpassant = move.typeOf() & Move::ENPASSANT;
-    bool is_castle = move.typeOf() & Move::CASTLING;      
-    bool is_null_move = move.typeOf() & Move::NULL_MOVE;
-
-    if (is_null_move) {
-        return; 
+    // Push the position after the move.
+    // To be called before board.makeMove(move).
+    void push(Board& board, Move move) {
+        AccumulatorPair& child = entries[++top];
+        child.dirty = DirtyPieces();
+
+        Color color = board.sideToMove();
+        int piece_idx = piecetype_to_idx(board.at<Piece>(move.from()).type());
+        int from = move.from().index();
+        int to = move.to().index();
+
+        if (move.typeOf() == Move::CASTLING) {
+            // Castling moves are encoded as king takes own rook
+            bool king_side = move.to() > move.from();
+            int king_to = Square::castling_king_square(king_side, color).index();
+            int rook_to = Square::castling_rook_square(king_side, color).index();
+            int rook_idx = piecetype_to_idx(PieceType::ROOK);
+
+            child.dirty.add(color, piece_idx, king_to);
+            child.dirty.add(color, rook_idx, rook_to);
+            child.dirty.sub(color, piece_idx, from);
+            child.dirty.sub(color, rook_idx, to);
+        } else if (move.typeOf() == Move::PROMOTION) {
+            child.dirty.add(color, piecetype_to_idx(move.promotionType()), to);
+            child.dirty.sub(color, piece_idx, from);
+
+            if (board.isCapture(move)) {
+                child.dirty.sub(~color, piecetype_to_idx(board.at<Piece>(move.to()).type()), to);
+            }
+        } else if (move.typeOf() == Move::ENPASSANT) {
+            child.dirty.add(color, piece_idx, to);
+            child.dirty.sub(color, piece_idx, from);
+            child.dirty.sub(~color, piece_idx, move.to().ep_square().index());
+        } else {
+            child.dirty.add(color, piece_idx, to);
+            child.dirty.sub(color, piece_idx, from);
+
+            if (board.isCapture(move)) {
+                child.dirty.sub(~color, piecetype_to_idx(board.at<Piece>(move.to()).type()), to);
+            }
+        }
+
+        child.computed = false;
     }
 
-    if (is_promotion || is_enpassant || is_castle) {
-        // For now calculate from scratch for promotion and enpassant
-        board.unmakeMove(move);
-        make_accumulators(board, white_accumulator, black_accumulator, eval_network);
-        board.makeMove(move);
-        return;
+    // Drop back to the parent position.
+    // To be called with board.unmakeMove(move).
+    void pop() {
+        top--;
     }
 
-    board.unmakeMove(move); 
+    // Accumulators of the current position, computing any pending entries first
+    AccumulatorPair& current(const Network& eval_network) {
+        int last = top;
+        while (!entries[last].computed) {
+            last--;
+        }
+
+        for (int i = last + 1; i <= top; i++) {
+            apply(entries[i - 1], entries[i], eval_network);
+        }
+
+        return entries[top];
+    }
 
-    Color color = board.sideToMove(); 
-    PieceType pieceType = board.at<Piece>(move.from()).type();
-    int piece_idx = piecetype_to_idx(pieceType);
+#ifdef NNUE_DEBUG
+    // Check the current accumulators against a rebuild from scratch
+    void verify(Board& board, Network& eval_network) {
+        Accumulator white, black;
+        make_accumulators(board, white, black, eval_network);
+
+        int n = eval_network.hidden_size;
+        if (!std::equal(white.vals.begin(), white.vals.begin() + n, entries[top].white.vals.begin())
+            || !std::equal(black.vals.begin(), black.vals.begin() + n, entries[top].black.vals.begin())) {
+            std::cerr << "NNUE accumulator mismatch at " << board.getFen() << std::endl;
+            std::abort();
+        }
+    }
+#endif
 
-    if (color == Color::WHITE) {
-        int from_idx_us = calculate_index(0, piece_idx, move.from().index());
-        int to_idx_us = calculate_index(0, piece_idx, move.to().index());
-        int from_idx_them = calculate_index(1, piece_idx, mirror_sq(move.from().index()));
-        int to_idx_them = calculate_index(1, piece_idx, mirror_sq(move.to().index()));
+private:
+    static void apply(const AccumulatorPair& parent, AccumulatorPair& child, const Network& eval_network) {
+        const DirtyPieces& dirty = child.dirty;
 
-        // Calculate index of from and to from "us" perspective
-        white_accumulator.add_feature(from_idx_us, eval_network);
-        white_accumulator.remove_feature(to_idx_us, eval_network);
-        black_accumulator.add_feature(from_idx_them, eval_network);
-        black_accumulator.remove_feature(to_idx_them, eval_network);
+        for (Color perspective : {Color::WHITE, Color::BLACK}) {
+            Accumulator& acc = perspective == Color::WHITE ? child.white : child.black;
+            const Accumulator& src = perspective == Color::WHITE ? parent.white : parent.black;
 
+            auto index = [&](const PieceFeature& f) {
+                return feature_index(perspective, f.color, f.piece_idx, f.square);
+            };
 
-        if (board.isCapture(move)) {
-            PieceType captured = board.at<Piece>(move.to()).type();
-            int captured_idx = piecetype_to_idx(captured);
+            int adds[2], subs[2];
+            for (int i = 0; i < dirty.num_adds; i++) adds[i] = index(dirty.adds[i]);
+            for (int i = 0; i < dirty.num_subs; i++) subs[i] = index(dirty.subs[i]);
 
-            // Put the black piece back in its original position from white's perspective
-            int capture_idx_us = calculate_index(1, captured_idx, move.to().index());
-            white_accumulator.add_feature(capture_idx_us, eval_network);
-            // Put the black piece back in its original position from black's perspective
-            int capture_idx_them = calculate_index(0, captured_idx, mirror_sq(move.to().index()));
-            black_accumulator.add_feature(capture_idx_them, eval_network); 
-        }
-    } else {
-        int from_idx_us = calculate_index(0, piece_idx, mirror_sq(move.from().index()));
-        int to_idx_us = calculate_index(0, piece_idx, mirror_sq(move.to().index()));
-        int from_idx_them = calculate_index(1, piece_idx, move.from().index());
-        int to_idx_them = calculate_index(1, piece_idx, move.to().index());
-
-        black_accumulator.add_feature(from_idx_us, eval_network);
-        black_accumulator.remove_feature(to_idx_us, eval_network);
-        white_accumulator.add_feature(from_idx_them, eval_network);
-        white_accumulator.remove_feature(to_idx_them, eval_network);
-
-        if (board.isCapture(move)) {            
-            PieceType captured = board.at<Piece>(move.to()).type();
-            int captured_idx = piecetype_to_idx(captured);
-
-            // Put the white piece back from black's perspective
-            int capture_idx_us = calculate_index(1, captured_idx, mirror_sq(move.to().index()));
-            black_accumulator.add_feature(capture_idx_us, eval_network);
-            // Put the white piece from white's perspective
-            int capture_idx_them = calculate_index(0, captured_idx, move.to().index());
-            white_accumulator.add_feature(capture_idx_them, eval_network);
+            acc.update(src, adds, dirty.num_adds, subs, dirty.num_subs, eval_network);
         }
-    }
 
-    board.makeMove(move);
-}
+        child.computed = true;
+    }
+};
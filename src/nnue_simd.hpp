@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define NNUE_X86 1
+    #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #define NNUE_NEON 1
+    #include <arm_neon.h>
+#endif
+
+// Vector kernels for the NNUE hot loops, one set per instruction set and hidden layer size n. The x86 kernels are compiled with
+// target attributes and the best one the CPU supports is picked at startup, so a generic build still
+// runs AVX2 / AVX-512 code. NEON is part of the aarch64 baseline and is selected at compile time.
+//
+// screlu_dot computes sum(screlu(us[i]) * w[i] + screlu(them[i]) * w[n + i]) over i < n.
+// The vector versions use clamp -> mullo -> madd: v * w is computed in int16 and multiplied by v again while
+// widening to int32 in madd. This is exact as long as QA * |w| fits in int16, i.e. |w| <= 128, which
+// load_network checks for the output weights.
+//
+// add_sub computes dst = src + sum(adds) - sum(subs) in one pass over the hidden layer.
+// The x86 kernels work on blocks of four registers, so n must be a multiple of 128.
+
+enum class SimdIsa {
+    SCALAR,
+    AVX2,
+    AVX512,
+    NEON
+};
+
+using ScreluDotKernel = int (*)(const int16_t* us, const int16_t* them, const int16_t* weights);
+using AddSubKernel = void (*)(int16_t* dst, const int16_t* src,
+                              const int16_t* const* adds, int num_adds,
+                              const int16_t* const* subs, int num_subs);
+
+// Hidden layer sizes with compiled kernels
+constexpr int SUPPORTED_HIDDEN_SIZES[] = {512, 1024};
+
+struct NnueKernels {
+    SimdIsa isa;
+    int hidden_size;
+    ScreluDotKernel screlu_dot;
+    AddSubKernel add_sub;
+};
+
+namespace nnue_simd {
+
+constexpr int QA = 255;
+
+template <int n>
+inline int screlu_dot_scalar(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    int output = 0;
+
+    #pragma omp simd reduction(+:output)
+    for (int i = 0; i < n; ++i) {
+        int u = std::clamp(static_cast<int>(us[i]), 0, QA);
+        int t = std::clamp(static_cast<int>(them[i]), 0, QA);
+        output += u * u * static_cast<int>(weights[i]) + t * t * static_cast<int>(weights[n + i]);
+    }
+
+    return output;
+}
+
+template <int n>
+inline void add_sub_scalar(int16_t* dst, const int16_t* src,
+                           const int16_t* const* adds, int num_adds,
+                           const int16_t* const* subs, int num_subs) {
+    if (dst != src) {
+        std::copy(src, src + n, dst);
+    }
+
+    for (int a = 0; a < num_adds; a++) {
+        const int16_t* add = adds[a];
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            dst[i] += add[i];
+        }
+    }
+
+    for (int s = 0; s < num_subs; s++) {
+        const int16_t* sub = subs[s];
+        #pragma omp simd
+        for (int i = 0; i < n; ++i) {
+            dst[i] -= sub[i];
+        }
+    }
+}
+
+#ifdef NNUE_X86
+
+template <int n>
+__attribute__((target("avx2")))
+inline int screlu_dot_avx2(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i qa = _mm256_set1_epi16(QA);
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int i = 0; i < n; i += 16) {
+        __m256i u = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(us + i));
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(them + i));
+        __m256i wu = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+        __m256i wt = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + n + i));
+
+        u = _mm256_min_epi16(_mm256_max_epi16(u, zero), qa);
+        t = _mm256_min_epi16(_mm256_max_epi16(t, zero), qa);
+
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_mullo_epi16(u, wu), u));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_mullo_epi16(t, wt), t));
+    }
+
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+    return _mm_cvtsi128_si32(half);
+}
+
+template <int n>
+__attribute__((target("avx2")))
+inline void add_sub_avx2(int16_t* dst, const int16_t* src,
+                         const int16_t* const* adds, int num_adds,
+                         const int16_t* const* subs, int num_subs) {
+    // Four registers per block, so each feature row pointer is loaded once per 64 lanes
+    for (int i = 0; i < n; i += 64) {
+        __m256i v[4];
+        for (int j = 0; j < 4; j++) {
+            v[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16 * j));
+        }
+        for (int a = 0; a < num_adds; a++) {
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm256_add_epi16(v[j], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(adds[a] + i + 16 * j)));
+            }
+        }
+        for (int s = 0; s < num_subs; s++) {
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm256_sub_epi16(v[j], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(subs[s] + i + 16 * j)));
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16 * j), v[j]);
+        }
+    }
+}
+
+template <int n>
+__attribute__((target("avx512f,avx512bw")))
+inline int screlu_dot_avx512(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i qa = _mm512_set1_epi16(QA);
+    __m512i sum = _mm512_setzero_si512();
+
+    for (int i = 0; i < n; i += 32) {
+        __m512i u = _mm512_loadu_si512(us + i);
+        __m512i t = _mm512_loadu_si512(them + i);
+        __m512i wu = _mm512_loadu_si512(weights + i);
+        __m512i wt = _mm512_loadu_si512(weights + n + i);
+
+        u = _mm512_min_epi16(_mm512_max_epi16(u, zero), qa);
+        t = _mm512_min_epi16(_mm512_max_epi16(t, zero), qa);
+
+        sum = _mm512_add_epi32(sum, _mm512_madd_epi16(_mm512_mullo_epi16(u, wu), u));
+        sum = _mm512_add_epi32(sum, _mm512_madd_epi16(_mm512_mullo_epi16(t, wt), t));
+    }
+
+    return _mm512_reduce_add_epi32(sum);
+}
+
+template <int n>
+__attribute__((target("avx512f,avx512bw")))
+inline void add_sub_avx512(int16_t* dst, const int16_t* src,
+                           const int16_t* const* adds, int num_adds,
+                           const int16_t* const* subs, int num_subs) {
+    for (int i = 0; i < n; i += 128) {
+        __m512i v[4];
+        for (int j = 0; j < 4; j++) {
+            v[j] = _mm512_loadu_si512(src + i + 32 * j);
+        }
+        for (int a = 0; a < num_adds; a++) {
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm512_add_epi16(v[j], _mm512_loadu_si512(adds[a] + i + 32 * j));
+            }
+        }
+        for (int s = 0; s < num_subs; s++) {
+            for (int j = 0; j < 4; j++) {
+                v[j] = _mm512_sub_epi16(v[j], _mm512_loadu_si512(subs[s] + i + 32 * j));
+            }
+        }
+        for (int j = 0; j < 4; j++) {
+            _mm512_storeu_si512(dst + i + 32 * j, v[j]);
+        }
+    }
+}
+
+#endif
+
+#ifdef NNUE_NEON
+
+template <int n>
+inline int screlu_dot_neon(const int16_t* us, const int16_t* them, const int16_t* weights) {
+    const int16x8_t zero = vdupq_n_s16(0);
+    const int16x8_t qa = vdupq_n_s16(QA);
+    int32x4_t sum = vdupq_n_s32(0);
+
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t u = vminq_s16(vmaxq_s16(vld1q_s16(us + i), zero), qa);
+        int16x8_t t = vminq_s16(vmaxq_s16(vld1q_s16(them + i), zero), qa);
+        int16x8_t uw = vmulq_s16(u, vld1q_s16(weights + i));
+        int16x8_t tw = vmulq_s16(t, vld1q_s16(weights + n + i));
+
+        sum = vmlal_s16(sum, vget_low_s16(uw), vget_low_s16(u));
+        sum = vmlal_high_s16(sum, uw, u);
+        sum = vmlal_s16(sum, vget_low_s16(tw), vget_low_s16(t));
+        sum = vmlal_high_s16(sum, tw, t);
+    }
+
+    return vaddvq_s32(sum);
+}
+
+template <int n>
+inline void add_sub_neon(int16_t* dst, const int16_t* src,
+                         const int16_t* const* adds, int num_adds,
+                         const int16_t* const* subs, int num_subs) {
+    for (int i = 0; i < n; i += 8) {
+        int16x8_t v = vld1q_s16(src + i);
+        for (int a = 0; a < num_adds; a++) v = vaddq_s16(v, vld1q_s16(adds[a] + i));
+        for (int s = 0; s < num_subs; s++) v = vsubq_s16(v, vld1q_s16(subs[s] + i));
+        vst1q_s16(dst + i, v);
+    }
+}
+
+#endif
+
+} // namespace nnue_simd
+
+inline const char* simd_isa_name(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::AVX2: return "avx2";
+        case SimdIsa::AVX512: return "avx512";
+        case SimdIsa::NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+inline bool simd_isa_supported(SimdIsa isa) {
+#ifdef NNUE_X86
+    __builtin_cpu_init(); // May run from a static initializer, before the runtime has done it
+#endif
+    switch (isa) {
+        case SimdIsa::SCALAR: return true;
+#ifdef NNUE_X86
+        case SimdIsa::AVX2: return __builtin_cpu_supports("avx2");
+        case SimdIsa::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+#ifdef NNUE_NEON
+        case SimdIsa::NEON: return true;
+#endif
+        default: return false;
+    }
+}
+
+// Instruction sets usable on this machine, from slowest to fastest
+inline std::vector<SimdIsa> supported_simd_isas() {
+    std::vector<SimdIsa> isas;
+    for (SimdIsa isa : {SimdIsa::SCALAR, SimdIsa::AVX2, SimdIsa::AVX512, SimdIsa::NEON}) {
+        if (simd_isa_supported(isa)) isas.push_back(isa);
+    }
+    return isas;
+}
+
+template <int n>
+inline NnueKernels make_nnue_kernels(SimdIsa isa) {
+    switch (isa) {
+#ifdef NNUE_X86
+        case SimdIsa::AVX2: return {isa, n, nnue_simd::screlu_dot_avx2<n>, nnue_simd::add_sub_avx2<n>};
+        case SimdIsa::AVX512: return {isa, n, nnue_simd::screlu_dot_avx512<n>, nnue_simd::add_sub_avx512<n>};
+#endif
+#ifdef NNUE_NEON
+        case SimdIsa::NEON: return {isa, n, nnue_simd::screlu_dot_neon<n>, nnue_simd::add_sub_neon<n>};
+#endif
+        default: return {SimdIsa::SCALAR, n, nnue_simd::screlu_dot_scalar<n>, nnue_simd::add_sub_scalar<n>};
+    }
+}
+
+// Kernels for a network with the given hidden layer size, which must be one of SUPPORTED_HIDDEN_SIZES
+inline NnueKernels make_nnue_kernels(SimdIsa isa, int hidden_size) {
+    return hidden_size == 512 ? make_nnue_kernels<512>(isa) : make_nnue_kernels<1024>(isa);
+}
+
+inline bool hidden_size_supported(int hidden_size) {
+    for (int size : SUPPORTED_HIDDEN_SIZES) {
+        if (size == hidden_size) return true;
+    }
+    return false;
+}
+
+// Instruction set used for networks loaded from now on. Defaults to the fastest supported one.
+inline SimdIsa nnue_isa = supported_simd_isas().back();
@@ -33,5 +33,7 @@ extern int singular_bonus;
 
 extern int max_extensions;
 
+extern int syzygy_probe_depth; // Minimum remaining depth for tablebase probes inside the tree
+
 
 
@@ -1,32 +1,53 @@
 #pragma once
 #include "chess.hpp"
 #include <atomic>
+#include <functional>
 
 using namespace chess;
 
 enum NodeType {PV = 0, CUT = 1, ALL = 2};
 
 // Constants & global variables
+constexpr int MAX_THREADS = 256;  // Maximum number of threads supported by the engine
+constexpr int MAX_HASH = 262144; // Maximum size of the transposition table in MB (256 GB)
 constexpr int INF = 1000000;
 constexpr int SZYZYGY_INF = 40000;
-extern int table_size; // Maximum size of the transposition table
-extern bool stop_search; // To signal if the search should stop based on time control
+extern std::atomic<bool> stop_search; // To signal if the search should stop based on time control
 extern std::atomic<bool> search_stopped; // Global stop flag for search based on UCI request
 
 
+struct SearchThread;
+
 struct NodeData {
     int ply;
     bool nmp_ok; // flag to signal if nmp is allowed
     int root_depth; // maximum depth to search from the root
     NodeType node_type;
     Move excluded_move;
-    int thread_id;
+    SearchThread* thread; // search state of the thread running this node
 };
 
 void reset_data();
+#ifdef COUNTER_BENCH
+void use_misra_gries_counters(bool enabled);
+#endif
+void set_num_threads(int num_threads);
+void resize_table(int hash_mb, int num_threads);
+void clear_table(int num_threads);
 bool initialize_nnue(std::string path);
-int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV, NodeData& node_data);
+bool initialize_embedded_nnue(const unsigned char* data, size_t size);
+void nnue_benchmark(const std::vector<Board>& positions, int iterations);
+bool see_test(const std::vector<Board>& positions);
+void perft_benchmark(const std::vector<Board>& positions, int depth);
+int negamax(Board& board, int depth, int alpha, int beta, NodeData& node_data);
 std::tuple<Move, int, int, std::vector<Move>> root_search(Board &board, int max_depth, int time_limit, int thread_id);
+void start_search(Board &board, int num_threads, int max_depth, int time_limit, std::function<void(Move)> on_done);
+void wait_search();
+std::pair<uint64_t, uint64_t> cutoff_stats();
+std::pair<uint64_t, uint64_t> wdl_cache_stats();
+#ifdef ALLOC_DEBUG
+uint64_t tree_allocation_count();
+#endif
 Move lazysmp_root_search(Board &board, int num_threads, int max_depth, int time_limit);
 
 
@@ -2,254 +2,574 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <omp.h> 
 #include <chrono>
 #include <stdlib.h>
 #include <cmath>
 #include <filesystem>
 #include <fstream>
-#include <mutex>
-#include <unordered_set>
+#include <bitset>
+#include <functional>
+#include <memory>
+#include <array>
+#include <cstdlib>
+#include <new>
 
 #include "nnue.hpp"
+#include "tt.hpp"
 #include "../lib/fathom/src/tbprobe.h"
 #include "search.hpp"
 #include "chess_utils.hpp"
 #include "utils.hpp"
+#ifdef COUNTER_BENCH
 #include "misra_gries.hpp"
+#endif
 #include "syzygy.hpp"
 #include "chess.hpp"
 #include "params.hpp"
+#include "thread_pool.hpp"
 
 using namespace chess;
 
 // Aliases, constants, and engine parameters
 typedef std::uint64_t U64;
-constexpr int MAX_THREADS = 12;  // Maximum number of threads supported by the engine
 constexpr int ENGINE_DEPTH = 128; // Maximum search depth supported by the engine
 constexpr int MAX_ASPIRATION_SZ = 300;
 constexpr int MAX_HIST = 5000;
 
-int table_size = 4194304; // Maximum size of the transposition table (default 256MB)
-bool stop_search = false; // To signal if the search should stop once the main thread is done
+// Bounds of the number of nodes between two time checks. The interval is adapted so that the clock is polled
+// about every POLL_PERIOD, which bounds the reaction time to "stop" and to the hard deadline.
+constexpr int MIN_POLL_INTERVAL = 16;
+constexpr int MAX_POLL_INTERVAL = 16384;
+constexpr auto POLL_PERIOD = std::chrono::microseconds(500);
 
-// Initalize NNUE, black and white accumulators
+std::atomic<bool> stop_search{false}; // To signal if the search should stop once the main thread is done
+int thread_count = 0; // Number of threads with allocated search state
+#ifdef COUNTER_BENCH
+bool misra_gries_counters = false; // Use the old Misra-Gries move pair counters instead of continuation history
+#endif
+
+// Continuation history is indexed by the piece-to of the previous move (row) and of the move (column).
+// The extra row is for a null move.
+constexpr int PIECE_TO_SIZE = 12 * 64;
+constexpr int NULL_PIECE_TO = PIECE_TO_SIZE;
+
+// Initalize NNUE
 Network nnue;
-std::vector<Accumulator> white_accumulator (MAX_THREADS); 
-std::vector<Accumulator> black_accumulator (MAX_THREADS);
 
-// Timer and statistics
+// Timer
 std::chrono::time_point<std::chrono::high_resolution_clock> hard_deadline; 
-std::vector<U64> node_count (MAX_THREADS); // Node count for each thread
-std::vector<U64> table_hit (MAX_THREADS); // Table hit count for each thread
 
-bool initialize_nnue(std::string path) {
-    std::cout << "Initializing NNUE from: " << path << std::endl;
-    if (load_network(path, nnue)) {
-        return true;
-    } else {
-        return false;
+// Measures evaluations and accumulator updates per second with each instruction set the CPU supports.
+// Updates are pushes of every legal move of each position, each materialized right away.
+// The checksum is the sum of all evaluations and must be the same for every instruction set.
+void nnue_benchmark(const std::vector<Board>& positions, int iterations) {
+    auto stack = std::make_unique<AccumulatorStack>();
+
+    std::cout << "==========================" << std::endl;
+    for (SimdIsa isa : supported_simd_isas()) {
+        nnue.select_kernels(isa);
+
+        uint64_t evals = 0;
+        uint64_t updates = 0;
+        int64_t checksum = 0;
+        double eval_seconds = 0;
+        double update_seconds = 0;
+
+        for (Board board : positions) {
+            stack->reset(board, nnue);
+            AccumulatorPair& root = stack->current(nnue);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < iterations; i++) {
+                checksum += nnue.evaluate(root.white, root.black);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            eval_seconds += std::chrono::duration<double>(end - start).count();
+            evals += iterations;
+
+            Movelist moves;
+            movegen::legalmoves(moves, board);
+
+            start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < iterations / 16 + 1; i++) {
+                for (const auto& move : moves) {
+                    stack->push(board, move);
+                    stack->current(nnue);
+                    stack->pop();
+                }
+            }
+            end = std::chrono::high_resolution_clock::now();
+            update_seconds += std::chrono::duration<double>(end - start).count();
+            updates += static_cast<uint64_t>(iterations / 16 + 1) * moves.size();
+        }
+
+        std::cout << simd_isa_name(isa) << ": "
+                  << static_cast<uint64_t>(evals / std::max(eval_seconds, 1e-9)) << " evals/s, "
+                  << static_cast<uint64_t>(updates / std::max(update_seconds, 1e-9)) << " updates/s, "
+                  << "checksum " << checksum << std::endl;
     }
+    std::cout << "==========================" << std::endl;
+
+    nnue.select_kernels(nnue_isa);
 }
 
-// History scores for quiet moves
-std::vector<std::vector<std::vector<int>>> history(MAX_THREADS, std::vector<std::vector<int>>(2, std::vector<int>(64 * 64, 0)));
+// Counts the nodes of a perft to depth from every position, once checking each node with isGameOver() and a
+// single repetition as the search used to and once with the search's own is_draw() plus the empty move list, and
+// reports nodes per second. Both modes stop on the same positions, so they walk the same tree.
+void perft_benchmark(const std::vector<Board>& positions, int depth) {
+    auto perft = [](auto& self, Board& board, int d, bool game_over_check) -> U64 {
+        bool over;
+        Movelist moves;
+        if (game_over_check) {
+            over = board.isGameOver().first != GameResultReason::NONE || board.isRepetition(1);
+            movegen::legalmoves(moves, board);
+        } else {
+            over = is_draw(board);
+            movegen::legalmoves(moves, board);
+            over = over || moves.empty();
+        }
 
-// Evaluations along the current path
-std::vector<std::vector<int>> static_eval(MAX_THREADS, std::vector<int>(ENGINE_DEPTH + 1, 0)); 
+        if (over || d == 0) {
+            return 1;
+        }
 
-// Killer moves for each thread and ply
-std::vector<std::vector<std::vector<Move>>> killer(MAX_THREADS, std::vector<std::vector<Move>> (ENGINE_DEPTH + 1, std::vector<Move>(1, Move::NO_MOVE))); 
+        U64 nodes = 1;
+        for (const auto& move : moves) {
+            board.makeMove(move);
+            nodes += self(self, board, d - 1, game_over_check);
+            board.unmakeMove(move);
+        }
+        return nodes;
+    };
+
+    std::cout << "==========================" << std::endl;
+    for (bool game_over_check : {true, false}) {
+        U64 nodes = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (Board board : positions) {
+            board.reserveMoves(depth + 1);
+            nodes += perft(perft, board, depth, game_over_check);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::max(std::chrono::duration<double>(end - start).count(), 1e-9);
 
-// Move stack for each thread
-std::vector<std::vector<int>> move_stack(MAX_THREADS, std::vector<int>(ENGINE_DEPTH + 1, 0));
+        std::cout << (game_over_check ? "isGameOver: " : "is_draw: ") << nodes << " nodes, "
+                  << static_cast<U64>(nodes / seconds) << " nodes/s" << std::endl;
+    }
+    std::cout << "==========================" << std::endl;
+}
 
-// Number of legal moves stack for each thread
-std::vector<std::vector<int>> legal_moves_stack(MAX_THREADS, std::vector<int>(ENGINE_DEPTH + 1, 0));
+// Exchange on the target square played out with makeMove and legal capture generation. Slow but exact,
+// it is the reference that see() is checked against.
+int see_reference(const Board& board, Move move) {
+    Square to = move.to();
+    std::vector<int> captured;
 
-// LMR table 
-std::vector<std::vector<int>> lmr_table; 
+    int victim = move.typeOf() == Move::ENPASSANT ? PAWN_VALUE : piece_type_value(board.at<PieceType>(to));
+    if (move.typeOf() == Move::PROMOTION) {
+        victim += piece_type_value(move.promotionType()) - PAWN_VALUE;
+    }
+    captured.push_back(victim);
 
-// Random seeds
-std::vector<uint32_t> seeds(MAX_THREADS);
+    Board copy = board;
+    copy.makeMove(move);
+    while (true) {
+        Movelist captures;
+        movegen::legalmoves<movegen::MoveGenType::CAPTURE>(captures, copy);
 
-// Misra-Gries for 1-2 ply pairs
-std::vector<std::vector<MisraGriesIntInt>> mg_2ply(MAX_THREADS, std::vector<MisraGriesIntInt>(2, MisraGriesIntInt(250)));  
+        Move best_capture = Move::NO_MOVE;
+        int best_value = INF;
+        for (const Move& capture : captures) {
+            if (capture.to() != to) continue;
+            if (capture.typeOf() == Move::PROMOTION && capture.promotionType() != PieceType::QUEEN) continue;
 
-// Singular move set
-std::vector<std::vector<std::unordered_set<int>>> singular_moves(MAX_THREADS, std::vector<std::unordered_set<int>>(2));
+            int value = piece_type_value(copy.at<PieceType>(capture.from()));
+            if (value < best_value) {
+                best_value = value;
+                best_capture = capture;
+            }
+        }
 
-// tt entry definition
-enum EntryType {
-    EXACT,
-    LOWERBOUND,
-    UPPERBOUND
-};  
+        if (best_capture == Move::NO_MOVE) break;
 
-struct alignas(64) TableEntry {
-    U64 hash;
-    int eval;
-    int depth;
-    bool pv; // this flag is used to check if the position is or was a PV node
-    Move best_move;
-    EntryType type;
-};
+        captured.push_back(piece_type_value(copy.at<PieceType>(to)));
+        copy.makeMove(best_capture);
+    }
 
-struct alignas(64) LockedTableEntry {
-    std::mutex mtx;
-    TableEntry entry;
-};
+    // Either side may stop capturing when it does not pay off
+    int score = captured.back();
+    for (int i = static_cast<int>(captured.size()) - 2; i >= 0; i--) {
+        score = captured[i] - std::max(0, score);
+    }
+    return score;
+}
 
-std::vector<LockedTableEntry> tt_table(table_size);
+// Checks see() and see_ge() against see_reference() on every capture of the given positions and of all
+// positions one move away from them. see_ge() must agree with see() on every threshold around the exact value,
+// any mismatch there fails the test. Differences between see() and the reference are printed but allowed, since
+// see() ignores checks and pins that appear during the exchange.
+bool see_test(const std::vector<Board>& positions) {
+    int tested = 0;
+    int see_mismatches = 0;
+    int see_ge_mismatches = 0;
 
-// helper function declarations
-void precompute_lmr(int max_depth, int max_i);
-inline bool table_lookup(Board& board, int& depth, int& eval, bool& pv,Move& best_move, EntryType& type, std::vector<LockedTableEntry>& table);
-inline void table_insert(Board& board, int depth, int eval, bool pv,Move best_move, EntryType type, std::vector<LockedTableEntry>& table);
-inline void update_killers(const Move& move, int ply, int thread_id);
-inline int see(Board& board, Move move, int thread_id);
-inline int late_move_reduction(Board& board, Move move, int i, int depth, int ply, bool is_pv, NodeType node_type, int thread_id);
-std::vector<std::pair<Move, int>> order_move(Board& board, int ply, int thread_id, bool& hash_move_found, NodeType node_type);
-int quiescence(Board& board, int alpha, int beta, int ply, int thread_id);
-void search_thread(Board search_board, int search_depth, int time_limit);
-Move lazysmp_root_search(Board &board, int num_threads, int max_depth, int time_limit);
+    auto check = [&](const Board& board) {
+        Movelist captures;
+        movegen::legalmoves<movegen::MoveGenType::CAPTURE>(captures, board);
 
-// reset all data for new game
-void reset_data() {
-    for (int i = 0; i < MAX_THREADS; ++i) {
-        std::fill(history[i][0].begin(), history[i][0].end(), 0);
-        std::fill(history[i][1].begin(), history[i][1].end(), 0);
-    }
-}
+        for (const Move& move : captures) {
+            int expected = see_reference(board, move);
+            int value = see(board, move);
+            tested++;
 
-// precompute the late move reduction table
-void precompute_lmr(int max_depth, int max_i) {
-    static bool is_precomputed = false;
-    if (is_precomputed) return;
+            if (value != expected) {
+                if (see_mismatches++ < 10) {
+                    std::cout << "see mismatch: " << board.getFen() << " " << uci::moveToUci(move, board.chess960())
+                              << " see " << value << " reference " << expected << std::endl;
+                }
+            }
 
-    lmr_table.resize(max_depth + 1, std::vector<int>(max_i + 1));
+            for (int threshold : {expected - 1, expected, expected + 1}) {
+                if (see_ge(board, move, threshold) != (value >= threshold)) {
+                    if (see_ge_mismatches++ < 10) {
+                        std::cout << "see_ge mismatch: " << board.getFen() << " " << uci::moveToUci(move, board.chess960())
+                                  << " threshold " << threshold << " see " << value << std::endl;
+                    }
+                }
+            }
+        }
+    };
 
-    for (int depth = max_depth; depth >= 1; --depth) {
-        for (int i = max_i; i >= 1; --i) {
-            lmr_table[depth][i] =  static_cast<int>(lmr_1 + lmr_2 * log(depth) * log(i));
+    for (Board board : positions) {
+        check(board);
+
+        Movelist moves;
+        movegen::legalmoves(moves, board);
+        for (const Move& move : moves) {
+            board.makeMove(move);
+            check(board);
+            board.unmakeMove(move);
         }
     }
-    is_precomputed = true;
+
+    std::cout << "==========================" << std::endl;
+    std::cout << "Captures tested: " << tested << std::endl;
+    std::cout << "see mismatches (allowed): " << see_mismatches << std::endl;
+    std::cout << "see_ge mismatches: " << see_ge_mismatches << std::endl;
+    std::cout << "Result: " << (see_ge_mismatches == 0 ? "PASS" : "FAIL") << std::endl;
+    std::cout << "==========================" << std::endl;
+    return see_ge_mismatches == 0;
+}
+
+// All search-local state of one thread in flat arrays. Each thread's state is a separate, cache-line aligned
+// allocation made by the thread itself, so hot counters of different threads never share a cache line.
+struct alignas(64) SearchThread {
+    int thread_id;
+
+    // Statistics
+    U64 node_count = 0;
+    U64 table_hit = 0;
+    U64 tb_hits = 0;
+    std::atomic<U64> wdl_cache_hits{0}; // Since the thread data was allocated, read by tbstats during a search
+    std::atomic<U64> wdl_cache_misses{0};
+    U64 cutoffs = 0; // Beta cutoffs in negamax
+    U64 first_move_cutoffs = 0; // Beta cutoffs on the first searched move
+
+    // Nodes left until the clock and the UCI stop flag are polled again, and the current polling interval
+    int poll_countdown = MIN_POLL_INTERVAL;
+    int poll_interval = MIN_POLL_INTERVAL;
+    std::chrono::high_resolution_clock::time_point last_poll;
+
+    // Accumulators of the positions on the current search path
+    AccumulatorStack accumulators;
+
+    // History scores for quiet moves
+    int history[2][64 * 64] = {};
+
+    // Evaluations along the current path
+    int static_eval[ENGINE_DEPTH + 1] = {};
+
+    // Triangular PV table. pv[ply] is the principal variation from ply on and pv_length[ply] its length.
+    Move pv[ENGINE_DEPTH + 2][ENGINE_DEPTH + 2] = {};
+    int pv_length[ENGINE_DEPTH + 2] = {};
+
+    // Killer moves for each ply
+    std::array<Move, 2> killer[ENGINE_DEPTH + 2] = {};
+
+    // Number of legal moves stack
+    int legal_moves_stack[ENGINE_DEPTH + 1] = {};
+
+    // Random seed
+    uint32_t seed = 0;
+
+    // Piece-to index of the move made at each ply
+    int piece_to_stack[ENGINE_DEPTH + 1] = {};
+
+    // Continuation history. Counts how often a move caused a beta cut-off after the opponent's last move
+    // ([0], counter move) and after our own previous move ([1], follow-up). Halved at the start of every search
+    // and cleared on ucinewgame.
+    uint16_t continuation_history[2][PIECE_TO_SIZE + 1][PIECE_TO_SIZE] = {};
+
+#ifdef COUNTER_BENCH
+    // Misra-Gries for 1-2 ply pairs, only used when misra_gries_counters is set
+    MisraGriesIntInt mg_2ply[2] = {MisraGriesIntInt(250), MisraGriesIntInt(250)};
+#endif
+
+    // Singular move set
+    std::bitset<64 * 64> singular_moves[2];
+
+    explicit SearchThread(int id) : thread_id(id) {}
+};
+
+std::vector<std::unique_ptr<SearchThread>> search_threads;
+
+#ifdef ALLOC_DEBUG
+// Heap allocations made while a search thread is inside the tree below the root. Counted by the replaced
+// operator new below, only while count_tree_allocations is set, so that bench can show the tree allocates nothing.
+// Only built with -DALLOC_DEBUG, as replacing operator new affects every allocation in the process.
+std::atomic<U64> tree_allocations{0};
+thread_local bool count_tree_allocations = false;
+
+U64 tree_allocation_count() {
+    return tree_allocations.load(std::memory_order_relaxed);
+}
+#endif
+
+// The PV at ply becomes move followed by the PV of the child
+inline void update_pv(SearchThread& st, int ply, Move move) {
+    int child_length = std::min(st.pv_length[ply + 1], ENGINE_DEPTH + 1);
+    st.pv[ply][0] = move;
+    std::copy(st.pv[ply + 1], st.pv[ply + 1] + child_length, st.pv[ply] + 1);
+    st.pv_length[ply] = child_length + 1;
 }
 
-// transposition table lookup function
-inline bool table_lookup(Board& board, 
-    int& depth, 
-    int& eval, 
-    bool& pv,
-    Move& best_move, 
-    EntryType& type,
-    std::vector<LockedTableEntry>& table) {  
-
-    U64 hash = board.hash();
-    U64 index = hash % table.size();
-    LockedTableEntry& locked_entry = table[index];
-    std::lock_guard<std::mutex> lock(locked_entry.mtx);  
-
-    if (locked_entry.entry.hash == hash) {
-        depth = locked_entry.entry.depth;
-        eval = locked_entry.entry.eval;
-        pv = locked_entry.entry.pv;
-        best_move = locked_entry.entry.best_move;
-        type = locked_entry.entry.type;
+// Whether the search has to be aborted. The internal stop flag is checked at every node so that an aborted
+// search unwinds at once. Reading the clock costs more than a quiescence node, so the clock and the UCI stop
+// flag are only polled every poll_interval nodes, with the interval doubled or halved to keep the time between
+// polls near POLL_PERIOD at the thread's current speed.
+inline bool should_stop(SearchThread& st) {
+    if (stop_search.load(std::memory_order_relaxed)) {
+        return true;
+    }
+
+    if (--st.poll_countdown > 0) {
+        return false;
+    }
+
+    auto now = std::chrono::high_resolution_clock::now();
+    auto elapsed = now - st.last_poll;
+    if (elapsed < POLL_PERIOD / 2) {
+        st.poll_interval = std::min(st.poll_interval * 2, MAX_POLL_INTERVAL);
+    } else if (elapsed > POLL_PERIOD * 2) {
+        st.poll_interval = std::max(st.poll_interval / 2, MIN_POLL_INTERVAL);
+    }
+    st.poll_countdown = st.poll_interval;
+    st.last_poll = now;
+
+    if (search_stopped.load(std::memory_order_relaxed) || now >= hard_deadline) {
+        stop_search = true;
         return true;
     }
 
     return false;
 }
 
-// transposition table insert function
-inline void table_insert(Board& board, 
-    int depth, 
-    int eval, 
-    bool pv,
-    Move best_move, 
-    EntryType type,
-    std::vector<LockedTableEntry>& table) {
+// LMR table 
+std::vector<std::vector<int>> lmr_table; 
+
+TranspositionTable tt_table;
 
-    U64 hash = board.hash();
-    U64 index = hash % table.size();
-    LockedTableEntry& locked_entry = table[index];
+// Result of the main search thread
+struct SearchResult {
+    Move best_move;
+    int depth;
+    int eval;
+    std::vector<Move> pv;
+};
+SearchResult search_result;
+
+// Persistent search workers, one per thread
+ThreadPool search_pool;
 
-    if (locked_entry.entry.hash == hash && locked_entry.entry.pv) {
-        pv = true; // don't overwrite the pv node if it was set
+#ifdef ALLOC_DEBUG
+void* operator new(std::size_t size) {
+    if (count_tree_allocations) {
+        tree_allocations.fetch_add(1, std::memory_order_relaxed);
     }
-        
-    std::lock_guard<std::mutex> lock(locked_entry.mtx); 
-    if (depth == locked_entry.entry.depth && type == EntryType::UPPERBOUND) {
-        return; // if the existing entry has the same depth, don't overwrite it with an upperbound
+
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
     }
-    locked_entry.entry = {hash, eval, depth, pv, best_move, type}; 
+    throw std::bad_alloc();
 }
 
-inline void update_killers(const Move& move, int ply, int thread_id) {
-    killer[thread_id][ply][0] = killer[thread_id][ply][1];
-    killer[thread_id][ply][1] = move;
-} 
+// Not inlined, so that the compiler does not pair the free() with the operator new call of the caller
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
 
-// Static exchange evaluation (SEE) function
-inline int see(Board& board, Move move, int thread_id) {
-    int to = move.to().index();
+__attribute__((noinline)) void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
 
-    auto victim = board.at<Piece>(move.to());
-    int victim_value = piece_type_value(victim.type());
+// helper function declarations
+void precompute_lmr(int max_depth, int max_i);
+inline void update_killers(const Move& move, int ply, SearchThread& st);
+inline int late_move_reduction(Board& board, Move move, int i, int depth, int ply, bool is_pv, NodeType node_type, SearchThread& st);
+int quiescence(Board& board, int alpha, int beta, int ply, SearchThread& st);
+Move lazysmp_root_search(Board &board, int num_threads, int max_depth, int time_limit);
 
-    thread_local std::vector<int> values;
-    thread_local std::vector<Move> exchange_stack;
+// reset all data for new game
+void reset_data() {
+    for (auto& st : search_threads) {
+        std::fill(&st->history[0][0], &st->history[0][0] + 2 * 64 * 64, 0);
+        std::fill(&st->continuation_history[0][0][0], &st->continuation_history[0][0][0] + 2 * (PIECE_TO_SIZE + 1) * PIECE_TO_SIZE, 0);
+    }
+}
 
-    values.clear();
-    exchange_stack.clear();
+#ifdef COUNTER_BENCH
+// Switches move ordering between continuation history and the old Misra-Gries counters, for counterbench
+void use_misra_gries_counters(bool enabled) {
+    misra_gries_counters = enabled;
+}
+#endif
 
-    values.push_back(victim_value);
-    exchange_stack.push_back(move);
+inline int piece_to_index(const Board& board, const Move& move) {
+    return static_cast<int>(board.at<Piece>(move.from())) * 64 + move.to().index();
+}
 
-    int depth = 0;
+// How often move followed the moves made at ply - 1 and ply - 2 in a beta cut-off
+inline int continuation_count(const Board& board, const Move& move, int ply, SearchThread& st) {
+    int piece_to = piece_to_index(board, move);
+#ifdef COUNTER_BENCH
+    if (misra_gries_counters) {
+        bool stm = board.sideToMove() == Color::WHITE;
+        return st.mg_2ply[stm].get_count({st.piece_to_stack[ply - 2], piece_to})
+             + st.mg_2ply[stm].get_count({st.piece_to_stack[ply - 1], piece_to});
+    }
+#endif
+    return st.continuation_history[0][st.piece_to_stack[ply - 1]][piece_to]
+         + st.continuation_history[1][st.piece_to_stack[ply - 2]][piece_to];
+}
 
-    Board copy = board;
-    while (!exchange_stack.empty()) {
-        Move current_move = exchange_stack.back();
-        exchange_stack.pop_back();
+// Counts move as a follow-up of the move made at ply - 2 and, if counter is set, as a counter to the move at ply - 1
+inline void update_continuation(const Board& board, const Move& move, int ply, bool counter, SearchThread& st) {
+    int piece_to = piece_to_index(board, move);
+#ifdef COUNTER_BENCH
+    if (misra_gries_counters) {
+        bool stm = board.sideToMove() == Color::WHITE;
+        st.mg_2ply[stm].insert({st.piece_to_stack[ply - 2], piece_to});
+        if (counter) st.mg_2ply[stm].insert({st.piece_to_stack[ply - 1], piece_to});
+        return;
+    }
+#endif
+    uint16_t& follow_up = st.continuation_history[1][st.piece_to_stack[ply - 2]][piece_to];
+    follow_up += follow_up < UINT16_MAX;
+    if (counter) {
+        uint16_t& counter_move = st.continuation_history[0][st.piece_to_stack[ply - 1]][piece_to];
+        counter_move += counter_move < UINT16_MAX;
+    }
+}
 
-        copy.makeMove(current_move); // Make the capture
-        node_count[thread_id]++;
-        Movelist captures;
-        movegen::legalmoves<movegen::MoveGenType::CAPTURE>(captures, copy);
+// Halve the continuation counts so that cut-offs from earlier positions of the game fade out, as the history
+// does. Each search thread ages its own tables when it starts, since they are too large to walk on the UCI thread.
+inline void age_continuation_history(SearchThread& st) {
+    uint16_t* counts = &st.continuation_history[0][0][0];
+    for (int j = 0; j < 2 * (PIECE_TO_SIZE + 1) * PIECE_TO_SIZE; j++) {
+        counts[j] /= 2;
+    }
+}
 
-        Move best_next_capture = Move::NO_MOVE;
-        int best_value = INF;
+// (re)allocate the per-thread search state, e.g. on "setoption name Threads"
+void set_num_threads(int num_threads) {
+    search_pool.wait(); // Workers of a running search still use the thread data
+    thread_count = num_threads;
 
-        for (const Move& next_capture : captures) {
-            if (next_capture.to().index() != to) continue; 
-            
-            int value = piece_type_value(copy.at<Piece>(next_capture.from()).type());
-            if (value < best_value) {
-                best_value = value;
-                best_next_capture = next_capture;
-            }
-        }
+    search_threads.clear();
+    search_threads.resize(num_threads);
+    search_pool.resize(num_threads);
 
-        if (best_next_capture == Move::NO_MOVE) break;
-        
-        values.push_back(best_value);
-        exchange_stack.push_back(best_next_capture);
+    // Each thread allocates its own state
+    search_pool.start(num_threads, [](int thread_id) {
+        search_threads[thread_id] = std::make_unique<SearchThread>(thread_id);
+    });
+    search_pool.wait();
+}
+
+// (re)allocate the transposition table, e.g. on "setoption name Hash"
+void resize_table(int hash_mb, int num_threads) {
+    search_pool.wait(); // Workers of a running search still probe the old table
+    tt_table.resize(hash_mb);
+    clear_table(num_threads);
+}
+
+// clear the transposition table in place for a new game
+void clear_table(int num_threads) {
+    num_threads = std::clamp(num_threads, 1, search_pool.size());
+    search_pool.start(num_threads, [num_threads](int thread_id) {
+        tt_table.clear_slice(thread_id, num_threads);
+    });
+    search_pool.wait();
+}
+
+// Make a freshly loaded network the current one
+void install_network(Network& net) {
+    search_pool.wait();
+    nnue = std::move(net);
+
+    // Cached accumulators belong to the previous network
+    for (auto& st : search_threads) {
+        if (st) st->accumulators.refresh_cache.clear();
     }
 
-    int n = values.size();
-    if (n == 0) return 0;
+    std::cout << "NNUE hidden size: " << nnue.hidden_size << ", kernels: " << simd_isa_name(nnue.kernels.isa) << std::endl;
+}
 
-    int score = values[n - 1];
-    for (int i = n - 2; i >= 0; --i) {
-        score = values[i] - std::max(0, score);
+// Load a network from a file, e.g. on "setoption name EvalFile". The current network is kept if loading fails.
+bool initialize_nnue(std::string path) {
+    std::cout << "Initializing NNUE from: " << path << std::endl;
+    Network net;
+    if (!load_network(path, net)) {
+        return false;
     }
 
-    return score;
+    install_network(net);
+    return true;
 }
 
+// Use the network embedded in the executable
+bool initialize_embedded_nnue(const unsigned char* data, size_t size) {
+    std::cout << "Initializing embedded NNUE" << std::endl;
+    Network net;
+    if (!load_embedded_network(data, size, net)) {
+        return false;
+    }
+
+    install_network(net);
+    return true;
+}
+
+// precompute the late move reduction table
+void precompute_lmr(int max_depth, int max_i) {
+    static bool is_precomputed = false;
+    if (is_precomputed) return;
+
+    lmr_table.resize(max_depth + 1, std::vector<int>(max_i + 1));
+
+    for (int depth = max_depth; depth >= 1; --depth) {
+        for (int i = max_i; i >= 1; --i) {
+            lmr_table[depth][i] =  static_cast<int>(lmr_1 + lmr_2 * log(depth) * log(i));
+        }
+    }
+    is_precomputed = true;
+}
+
+inline void update_killers(const Move& move, int ply, SearchThread& st) {
+    st.killer[ply][0] = st.killer[ply][1];
+    st.killer[ply][1] = move;
+} 
+
 // Late move reduction 
 inline int late_move_reduction(Board& board, 
                                 Move move, 
@@ -258,7 +578,7 @@ inline int late_move_reduction(Board& board,
                                 int ply, 
                                 bool is_pv, 
                                 NodeType node_type,
-                                int thread_id) {
+                                SearchThread& st) {
 
     if (is_mopup(board)) {
         return depth - 1;
@@ -270,7 +590,7 @@ inline int late_move_reduction(Board& board,
     if (i <= 1 || depth <= 3 || is_promotion_threat) {
         return depth - 1;
     } else {
-        bool improving = ply >= 2 && static_eval[thread_id][ply - 2] < static_eval[thread_id][ply] && !board.inCheck();
+        bool improving = ply >= 2 && st.static_eval[ply - 2] < st.static_eval[ply] && !board.inCheck();
         bool is_capture = board.isCapture(move);
         
         int R = lmr_table[depth][i];
@@ -295,130 +615,255 @@ inline int late_move_reduction(Board& board,
     }
 }
 
-// generate ordered moves for the current position]
-std::vector<std::pair<Move, int>> order_move(Board& board, int ply, int thread_id, bool& hash_move_found, NodeType node_type) {
+// Staged move picker. Moves are handed out in stages so that a node which cuts off on the hash move or on an
+// early capture never scores the moves it does not search: hash move, good captures, killers, counter move,
+// captures that lose material and finally quiets by history. Captures are ordered by MVV-LVA and only checked
+// with see_ge when they are picked. Within a stage the best remaining move is found by selection.
+// All legal moves are generated up front, since the move count drives the one-reply extension.
+// The moves are scored in place in the generated list, which is split into ranges: captures, then quiets.
+// Captures that fail see_ge are moved down into the slots of the captures already picked.
+enum class PickStage {
+    TT_MOVE,
+    INIT_CAPTURES,
+    GOOD_CAPTURES,
+    KILLERS,
+    COUNTER,
+    BAD_CAPTURES,
+    INIT_QUIETS,
+    QUIETS,
+    DONE
+};
+
+// Moves the best scored move of moves[index, end) to moves[index] and returns it
+inline Move select_move(Movelist& moves, int& index, int end) {
+    int best = index;
+    for (int i = index + 1; i < end; i++) {
+        if (moves[i].score() > moves[best].score()) {
+            best = i;
+        }
+    }
+    std::swap(moves[index], moves[best]);
+    return moves[index++];
+}
+
+struct MovePicker {
+    Board& board;
+    SearchThread& st;
+    int ply;
+    PickStage stage = PickStage::INIT_CAPTURES;
 
     Movelist moves;
-    movegen::legalmoves(moves, board);
+    Move tt_move = Move::NO_MOVE;
+    Move killers[2] = {Move::NO_MOVE, Move::NO_MOVE};
+    Move counter = Move::NO_MOVE;
+    int killer_index = 0;
+
+    // Ranges of moves: bad captures [0, bad_end), captures [capture_index, capture_end), quiets [quiet_index, quiet_end)
+    int bad_end = 0, bad_index = 0;
+    int capture_index = 0, capture_end = 0;
+    int quiet_index = 0, quiet_end = 0;
+
+    // The hash move is only used if it is legal in this position.
+    MovePicker(Board& position, int node_ply, SearchThread& thread, Move hash_move) : board(position), st(thread), ply(node_ply) {
+        movegen::legalmoves(moves, board);
+
+        if (hash_move != Move::NO_MOVE && std::find(moves.begin(), moves.end(), hash_move) != moves.end()) {
+            tt_move = hash_move;
+            stage = PickStage::TT_MOVE;
+        }
+    }
 
-    thread_local std::vector<std::pair<Move, int>> primary;
-    thread_local std::vector<std::pair<Move, int>> quiet;
+    int size() const {
+        return moves.size();
+    }
 
-    primary.clear();
-    quiet.clear();
+    bool hash_move_found() const {
+        return tt_move != Move::NO_MOVE;
+    }
 
-    bool stm = board.sideToMove() == Color::WHITE;
-    Color color = board.sideToMove();
-    U64 hash = board.hash();
-
-    // A pair is either (ply - 1, ply) or (ply - 2, ply) that caused beta cut-off
-    // We try to find the best pair give it higher priority.
-    Move best_2ply_move = Move::NO_MOVE;
-    int best_2ply_score = -INF;
-    int move_index_1 = 0;
-    int move_index_2 = 0;
-
-    if (ply >= 2) {
-        move_index_2 = move_index(move_stack[thread_id][ply - 2]);
-        move_index_1 = move_index(move_stack[thread_id][ply - 1]);
-        for (const auto& move : moves) {
-            int move_index_0 = move_index(move);
-            std::pair<int, int> pair_1 = {move_index_2, move_index_0};
-            std::pair<int, int> pair_2 = {move_index_1, move_index_0};
-
-            int count = mg_2ply[thread_id][stm].get_count(pair_1) + mg_2ply[thread_id][stm].get_count(pair_2);
-            if (count > best_2ply_score) {
-                best_2ply_score = count;
-                best_2ply_move = move;
+    // Returns the next move or Move::NO_MOVE once all moves have been picked
+    Move next() {
+        switch (stage) {
+        case PickStage::TT_MOVE:
+            stage = PickStage::INIT_CAPTURES;
+            return tt_move;
+
+        case PickStage::INIT_CAPTURES:
+            split_moves();
+            stage = PickStage::GOOD_CAPTURES;
+            [[fallthrough]];
+
+        case PickStage::GOOD_CAPTURES:
+            while (capture_index < capture_end) {
+                Move move = select_move(moves, capture_index, capture_end);
+                if (is_promotion(move) || see_ge(board, move, 0)) {
+                    return move;
+                }
+                moves[bad_end++] = move;
+            }
+            stage = PickStage::KILLERS;
+            [[fallthrough]];
+
+        case PickStage::KILLERS:
+            while (killer_index < 2) {
+                Move killer = killers[killer_index++];
+                if (killer != Move::NO_MOVE) {
+                    return killer;
+                }
+            }
+            stage = PickStage::COUNTER;
+            [[fallthrough]];
+
+        case PickStage::COUNTER:
+            stage = PickStage::BAD_CAPTURES;
+            find_counter();
+            if (counter != Move::NO_MOVE) {
+                return counter;
+            }
+            [[fallthrough]];
+
+        case PickStage::BAD_CAPTURES:
+            if (bad_index < bad_end) {
+                return select_move(moves, bad_index, bad_end);
+            }
+            stage = PickStage::INIT_QUIETS;
+            [[fallthrough]];
+
+        case PickStage::INIT_QUIETS:
+            score_quiets();
+            stage = PickStage::QUIETS;
+            [[fallthrough]];
+
+        case PickStage::QUIETS:
+            while (quiet_index < quiet_end) {
+                Move move = select_move(moves, quiet_index, quiet_end);
+                if (move != killers[0] && move != killers[1] && move != counter) {
+                    return move;
+                }
             }
+            stage = PickStage::DONE;
+            return Move::NO_MOVE;
+
+        case PickStage::DONE:
+            return Move::NO_MOVE;
         }
-    }
 
-    for (const auto& move : moves) {
-        Move tt_move;
-        EntryType tt_type;
-        TableEntry entry;
-        int tt_eval, tt_depth, priority = 0;
-        bool tt_pv;
-        bool secondary = false;
-        bool hash_move = false;
+        return Move::NO_MOVE;
+    }
 
-        if (table_lookup(board, tt_depth, tt_eval, tt_pv, tt_move, tt_type, tt_table)) {
-            // Hash move from the PV transposition table should be searched first 
-            if (tt_move == move) {
-                priority = 19000 + tt_eval;
-                primary.push_back({tt_move, priority});
-                hash_move = true;
-                hash_move_found = true;
-            } 
-        } 
-      
-        if (hash_move) continue;
-
-        if (is_promotion(move)) {                   
-            priority = 16000; 
-        } else if (board.isCapture(move)) { 
-            int capture_score = see(board, move, thread_id);
-            priority = 4000 + capture_score;
-        } else if (killer[thread_id][ply][0] == move || killer[thread_id][ply][1] == move) {
-            priority = 3900; 
-        } else if (move == best_2ply_move) {
-            priority = 3950;
-        } else {
-            secondary = true;
-            int move_idx = move_index(move);
-            int singular_bonus = singular_moves[thread_id][stm].find(move_idx) != singular_moves[thread_id][stm].end() ? 100 : 0;
-            priority = history[thread_id][stm][move_idx] + singular_bonus;
-        } 
+private:
+    // Drops the hash move and splits the rest into captures (scored by MVV-LVA, queen promotions first) at the
+    // front and quiets behind them, and finds the killers among the quiets.
+    void split_moves() {
+        Move killer_0 = st.killer[ply][1]; // Most recent killer first
+        Move killer_1 = st.killer[ply][0];
+
+        int end = moves.size();
+        if (tt_move != Move::NO_MOVE) {
+            Move* found = std::find(moves.begin(), moves.end(), tt_move);
+            *found = moves[--end];
+        }
 
-        if (!secondary) {
-            primary.push_back({move, priority});
-        } else {
-            quiet.push_back({move, priority});
+        for (int i = 0; i < end; i++) {
+            Move move = moves[i];
+            if (is_promotion(move) || board.isCapture(move)) {
+                int victim_value = piece_type_value(board.at<Piece>(move.to()).type());
+                int attacker_value = piece_type_value(board.at<Piece>(move.from()).type());
+                int score = 10 * victim_value - attacker_value + (is_promotion(move) ? 10 * piece_type_value(move.promotionType()) : 0);
+                moves[i] = moves[capture_end];
+                moves[capture_end] = move;
+                moves[capture_end++].setScore(score);
+            } else {
+                if (move == killer_0) killers[0] = move;
+                if (move == killer_1 && killer_1 != killer_0) killers[1] = move;
+            }
         }
+        quiet_index = capture_end;
+        quiet_end = end;
     }
 
-    std::sort(primary.begin(), primary.end(), [&stm, &thread_id](const auto& a, const auto& b) {
-        return a.second > b.second;
-    }); 
+    // Finds the quiet that most often followed the last two moves in a beta cut-off (follow-up and counter move).
+    // Only reached once the hash move, the good captures and the killers have failed to cut off.
+    void find_counter() {
+        if (ply >= 2) {
+            int best_count = 0;
 
-    std::sort(quiet.begin(), quiet.end(), [&stm, &thread_id](const auto& a, const auto& b) {
-        return a.second > b.second;
-    });
+            for (int i = quiet_index; i < quiet_end; i++) {
+                Move move = moves[i];
+                if (move == killers[0] || move == killers[1]) continue;
 
-    for (const auto& move : quiet) {
-        primary.push_back(move);
+                int count = continuation_count(board, move, ply, st);
+                if (count > best_count) {
+                    best_count = count;
+                    counter = move;
+                }
+            }
+        }
     }
 
-    return primary;
-}
+    void score_quiets() {
+        bool stm = board.sideToMove() == Color::WHITE;
+        for (int i = quiet_index; i < quiet_end; i++) {
+            int move_idx = move_index(moves[i]);
+            int bonus = st.singular_moves[stm].test(move_idx) ? singular_bonus : 0;
+            moves[i].setScore(st.history[stm][move_idx] + bonus);
+        }
+    }
+};
+
+// Move picker of the quiescence search. Only captures are generated and they are handed out by MVV-LVA.
+struct CapturePicker {
+    Movelist moves;
+    int index = 0;
+
+    explicit CapturePicker(const Board& board) {
+        movegen::legalmoves<movegen::MoveGenType::CAPTURE>(moves, board);
+        for (auto& move : moves) {
+            int victim_value = piece_type_value(board.at<Piece>(move.to()).type());
+            int attacker_value = piece_type_value(board.at<Piece>(move.from()).type());
+            move.setScore(victim_value - attacker_value);
+        }
+    }
+
+    // Returns the next capture or Move::NO_MOVE once all captures have been picked
+    Move next() {
+        if (index < moves.size()) {
+            return select_move(moves, index, moves.size());
+        }
+        return Move::NO_MOVE;
+    }
+};
 
 // Quiescence search 
-int quiescence(Board& board, int alpha, int beta, int ply, int thread_id) {
+int quiescence(Board& board, int alpha, int beta, int ply, SearchThread& st) {
 
-    // Stop the search if hard deadline is reached
-    auto current_time = std::chrono::high_resolution_clock::now();
-    if (current_time >= hard_deadline || stop_search) {
-        stop_search = true;
+    // Stop the search on a UCI stop request or if the hard deadline is reached
+    if (should_stop(st)) {
         return 0;
     }
     
-    // Check if the game is over. 
-    auto game_over_result = board.isGameOver();
-    if (game_over_result.first != GameResultReason::NONE) {
-        if (game_over_result.first == GameResultReason::CHECKMATE) {
-            return -INF/2; 
-        }
+    if (is_draw(board)) {
         return 0;
     }
 
+    // Only captures are generated below, so mate is checked here when in check. Stalemate is checked with
+    // has_legal_move() only where the stand pat is returned.
+    bool in_check = board.inCheck();
+    if (in_check) {
+        Movelist evasions;
+        movegen::legalmoves(evasions, board);
+        if (evasions.empty()) {
+            return -INF/2;
+        }
+    }
+
     bool stm = (board.sideToMove() == Color::WHITE);
     int stand_pat = 0;
 
-    // Probe Syzygy tablebases
-    Move syzygy_move = Move::NO_MOVE;
+    // Probe Syzygy tablebases. Quiescence nodes count as depth 0.
     int wdl = 0;
-    if (syzygy::probe_syzygy(board, syzygy_move, wdl)) {
+    if (syzygy_probe_depth <= 0 && syzygy::probe_wdl(board, wdl, st.wdl_cache_hits, st.wdl_cache_misses)) {
+        st.tb_hits++;
         int score = 0;
         if (wdl == 1) {
             // get the fastest path to known win by subtracting the ply
@@ -432,49 +877,41 @@ int quiescence(Board& board, int alpha, int beta, int ply, int thread_id) {
         return score;
     }
 
-    Movelist moves;
-    movegen::legalmoves<movegen::MoveGenType::CAPTURE>(moves, board);
-
     if (is_mopup(board)) {
         int color = (board.sideToMove() == Color::WHITE) ? 1 : -1;
         stand_pat = color * mopup_score(board);
     } else {
+        AccumulatorPair& acc = st.accumulators.current(nnue);
+#ifdef NNUE_DEBUG
+        st.accumulators.verify(board, nnue);
+#endif
         if (stm == 1) {
-            stand_pat = nnue.evaluate(white_accumulator[thread_id], black_accumulator[thread_id]);
+            stand_pat = nnue.evaluate(acc.white, acc.black);
         } else {
-            stand_pat = nnue.evaluate(black_accumulator[thread_id], white_accumulator[thread_id]);
+            stand_pat = nnue.evaluate(acc.black, acc.white);
         }
     }
 
     int best_score = stand_pat;
     if (stand_pat >= beta) {
-        return stand_pat;
+        return (in_check || has_legal_move(board)) ? stand_pat : 0;
     }
 
     alpha = std::max(alpha, stand_pat);
-    std::vector<std::pair<Move, int>> candidate_moves;
-    candidate_moves.reserve(moves.size());
-
-    for (const auto& move : moves) {
-        int victim_value = piece_type_value(board.at<Piece>(move.to()).type());
-        int attacker_value = piece_type_value(board.at<Piece>(move.from()).type());
-        int score = victim_value - attacker_value;
-        candidate_moves.push_back({move, score});
-    }
+    CapturePicker picker(board);
+    bool any_capture = false;
 
-    std::sort(candidate_moves.begin(), candidate_moves.end(), [](const auto& a, const auto& b) {
-        return a.second > b.second;
-    });
-
-    for (auto& [move, priority] : candidate_moves) {
-        add_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+    for (Move move = picker.next(); move != Move::NO_MOVE; move = picker.next()) {
+        any_capture = true;
+        tt_prefetch(board.hashAfter(move), tt_table);
+        st.accumulators.push(board, move);
         board.makeMove(move);
-        node_count[thread_id]++;
+        st.node_count++;
         
         int score = 0;
-        score = -quiescence(board, -beta, -alpha, ply + 1, thread_id);
+        score = -quiescence(board, -beta, -alpha, ply + 1, st);
 
-        subtract_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+        st.accumulators.pop();
         board.unmakeMove(move);
 
         best_score = std::max(best_score, score);
@@ -484,32 +921,31 @@ int quiescence(Board& board, int alpha, int beta, int ply, int thread_id) {
             return alpha;
         }
     }
+
+    if (!any_capture && !in_check && !has_legal_move(board)) {
+        return 0;
+    }
     return best_score;
 }
 
 // Negamax main search function
-int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV, NodeData& data) {
+int negamax(Board& board, int depth, int alpha, int beta, NodeData& data) {
 
-    // Handle UCI stop search request
-    if (search_stopped.load()) {
-        stop_search = true; // Signal that the result is not valid
-        return 0; 
-    }
+    SearchThread& st = *data.thread;
+    st.pv_length[data.ply] = 0;
 
-    // Stop the search if hard deadline is reached
-    auto current_time = std::chrono::high_resolution_clock::now();
-    if (current_time >= hard_deadline || stop_search) {
-        stop_search = true;
+    // Stop the search on a UCI stop request or if the hard deadline is reached
+    if (should_stop(st)) {
         return 0;
     }
 
-    int thread_id = data.thread_id;
     int ply = data.ply;
     int root_depth = data.root_depth;
     bool mopup_flag = is_mopup(board);
     Move excluded_move = data.excluded_move;
 
-    std::vector<Move> bad_quiets;
+    Move bad_quiets[constants::MAX_MOVES];
+    int bad_quiet_count = 0;
     bool nmp_ok = data.nmp_ok;
     NodeType node_type = data.node_type;
 
@@ -517,24 +953,17 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
     int alpha0 = alpha; // Original alpha passed from the parent node
     bool stm = (board.sideToMove() == Color::WHITE);
     
-    // Check if the game is over. 
-    auto game_over_result = board.isGameOver();
-    if (game_over_result.first != GameResultReason::NONE) {
-        if (game_over_result.first == GameResultReason::CHECKMATE) {
-            return -INF/2; // Mate distance pruning.
-        }
-        return 0;
-    }
-
-    // Avoid searching the same position multiple times in the same path
-    if (board.isRepetition(1)) {
+    // Fifty-move rule, insufficient material and repetitions. A single repetition is scored as a draw to avoid
+    // searching the same position multiple times in the same path. Mate and stalemate are found by the move loop,
+    // or by has_legal_move() where a pruning step returns before it.
+    if (is_draw(board)) {
         return 0;
     }
 
     // Probe Syzygy tablebases
-    Move syzygy_move = Move::NO_MOVE;
     int wdl = 0;
-    if (syzygy::probe_syzygy(board, syzygy_move, wdl)) { 
+    if (depth >= syzygy_probe_depth && syzygy::probe_wdl(board, wdl, st.wdl_cache_hits, st.wdl_cache_misses)) {
+        st.tb_hits++;
         int score = 0;
         if (wdl == 1) {
             // get the fastest path to known win by subtracting the ply
@@ -550,17 +979,16 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
 
     // Probe the transposition table
     bool found = false;
-    int tt_eval, tt_depth, extensions = 0;
+    int tt_eval = 0, tt_depth = 0, extensions = 0;
     bool tt_pv = false;
-    bool improving = ply >= 2 && static_eval[thread_id][ply - 2] < static_eval[thread_id][ply] && !board.inCheck();
+    bool improving = ply >= 2 && st.static_eval[ply - 2] < st.static_eval[ply] && !board.inCheck();
 
     Move tt_move;
-    EntryType tt_type;
-    TableEntry entry;
+    EntryType tt_type = EntryType::UPPERBOUND;
     bool tt_hit = false;
 
     if (table_lookup(board, tt_depth, tt_eval, tt_pv, tt_move, tt_type, tt_table)) {
-        table_hit[thread_id]++;
+        st.table_hit++;
         if (tt_depth >= depth) found = true;
         tt_hit = true;
     }
@@ -581,18 +1009,22 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
     }
     
     if (depth <= 0 && !board.inCheck()) {
-        int q_eval = quiescence(board, alpha, beta, ply + 1, thread_id);
+        int q_eval = quiescence(board, alpha, beta, ply + 1, st);
         eval_adjust(q_eval);
         return q_eval;
     } else if (depth <= 0) {
-        return negamax(board, 1, alpha, beta, PV, data);
+        return negamax(board, 1, alpha, beta, data);
     }
 
     int stand_pat = 0;
+    AccumulatorPair& acc = st.accumulators.current(nnue);
+#ifdef NNUE_DEBUG
+    st.accumulators.verify(board, nnue);
+#endif
     if (stm == 1) {
-        stand_pat = nnue.evaluate(white_accumulator[thread_id], black_accumulator[thread_id]);
+        stand_pat = nnue.evaluate(acc.white, acc.black);
     } else {
-        stand_pat = nnue.evaluate(black_accumulator[thread_id], white_accumulator[thread_id]);
+        stand_pat = nnue.evaluate(acc.black, acc.white);
     }
 
     // Adjust static evaluation based on tt. Add some random noise?
@@ -606,9 +1038,8 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
 
     bool capture_tt_move = found && tt_move != Move::NO_MOVE && board.isCapture(tt_move);
     
-    static_eval[thread_id][ply] = stand_pat; 
-    killer[thread_id][ply + 1] = {Move::NO_MOVE, Move::NO_MOVE}; 
-    bool hash_move_found = false;
+    st.static_eval[ply] = stand_pat; 
+    st.killer[ply + 1] = {Move::NO_MOVE, Move::NO_MOVE}; 
     bool pre_loop_prune_condition = !board.inCheck() && !is_pv && !mopup_flag && excluded_move == Move::NO_MOVE;
     
 
@@ -620,7 +1051,7 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
     if (rfp_condition) {
         int rfp_margin = rfp_c1 * (depth - improving);
         if (stand_pat >= beta + rfp_margin) {
-            return (stand_pat + beta) / 2;
+            return has_legal_move(board) ? (stand_pat + beta) / 2 : 0;
         }
     }
 
@@ -630,7 +1061,7 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
                     && !tt_pv 
                     && stand_pat < alpha - rz_c1 * (depth + improving);
     if (rz_condition) {
-        int rz_eval = quiescence(board, alpha, beta, ply + 1, thread_id);
+        int rz_eval = quiescence(board, alpha, beta, ply + 1, st);
         return rz_eval;
     }
     
@@ -643,28 +1074,32 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
 
     int null_eval;
     if (nmp_condition) {
-        std::vector<Move> null_pv; 
         int reduction = 3 + depth / 4;
         NodeData null_data = {ply + 1, 
                                 false, 
                                 root_depth,
                                 NodeType::ALL, 
                                 Move::NO_MOVE,
-                                thread_id};
-        move_stack[thread_id][ply] = -1;
+                                &st};
+        st.piece_to_stack[ply] = NULL_PIECE_TO;
         board.makeNullMove();
-        null_pv.push_back(Move::NULL_MOVE);
-        null_eval = -negamax(board, depth - reduction, -beta, -(beta - 1), null_pv, null_data);
+        null_eval = -negamax(board, depth - reduction, -beta, -(beta - 1), null_data);
         eval_adjust(null_eval);
         board.unmakeNullMove();
 
         if (null_eval >= beta) {
-            return beta;
+            return has_legal_move(board) ? beta : 0;
         } 
     }
 
     int best_eval = -INF;
-    std::vector<std::pair<Move, int>> moves = order_move(board, ply, thread_id, hash_move_found, node_type);
+    MovePicker picker(board, ply, st, tt_hit ? tt_move : Move::NO_MOVE);
+    bool hash_move_found = picker.hash_move_found();
+
+    // Checkmate or stalemate
+    if (picker.size() == 0) {
+        return board.inCheck() ? -INF/2 : 0;
+    }
 
     // IID. Reduce the depth to facilitate the search if no hash move found.
     if (!hash_move_found && depth >= 3) {
@@ -681,29 +1116,29 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
     ) {
         int singular_eval = -INF;
         int singular_beta = tt_eval - singular_c1 * depth - singular_c2; 
-        std::vector<Move> singular_pv;
         NodeData singular_node_data = {ply, 
             false, 
             root_depth,
             NodeType::ALL, 
             tt_move,
-            thread_id};
+            &st};
 
-        singular_eval = negamax(board, (depth - 1) / 2, singular_beta - 1, singular_beta, singular_pv, singular_node_data);
+        singular_eval = negamax(board, (depth - 1) / 2, singular_beta - 1, singular_beta, singular_node_data);
+        st.pv_length[ply] = 0; // The singular search ran at this ply and left its PV here
 
         if (singular_eval < singular_beta) {
             extensions++; // singular extension
             if (singular_eval < singular_beta - 40) {
                 extensions++; // double extension
             } 
-            singular_moves[thread_id][stm].insert(move_index(tt_move)); 
+            st.singular_moves[stm].set(move_index(tt_move)); 
         } 
     }
 
-    legal_moves_stack[thread_id][ply] = moves.size();
+    st.legal_moves_stack[ply] = picker.size();
 
     // One-reply extension
-    if (moves.size() == 1) {
+    if (picker.size() == 1) {
         extensions++;
     }
 
@@ -715,10 +1150,9 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
     extensions = std::clamp(extensions, 0, 2); 
 
     // Evaluate moves
-    for (int i = 0; i < moves.size(); i++) {
-
-        Move move = moves[i].first;
-        std::vector<Move> childPV;
+    int moves_searched = 0;
+    Move move;
+    for (int i = 0; (move = picker.next()) != Move::NO_MOVE; i++) {
 
         if (move == excluded_move) {
             continue; // skip excluded move
@@ -729,13 +1163,10 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
         bool is_capture = board.isCapture(move);
         bool is_promotion_threat = promotion_threat(board, move) || is_promo; 
 
-        board.makeMove(move);
-        node_count[thread_id]++;
-        bool give_check = board.inCheck();
-        board.unmakeMove(move);
+        bool give_check = board.givesCheck(move);
 
         int eval = 0;
-        int next_depth = late_move_reduction(board, move, i, depth, ply, is_pv, node_type, thread_id); 
+        int next_depth = late_move_reduction(board, move, i, depth, ply, is_pv, node_type, st); 
 
         next_depth = std::min(next_depth + extensions, (max_extensions + root_depth) - ply - 1);
 
@@ -766,10 +1197,12 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
             }
         }
 
-        add_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
-        move_stack[thread_id][ply] = move_index(move);
+        tt_prefetch(board.hashAfter(move), tt_table);
+        st.accumulators.push(board, move);
+        st.piece_to_stack[ply] = piece_to_index(board, move);
         board.makeMove(move);
-        node_count[thread_id]++;
+        st.node_count++;
+        moves_searched++;
         
         bool null_window = false;
         bool reduced_depth = next_depth < depth - 1;
@@ -779,7 +1212,7 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
                                 root_depth,
                                 NodeType::PV,
                                 excluded_move,
-                                thread_id};
+                                &st};
 
         // PVS: Full window for the first node. 
         // Once alpha is raised, we search with null window until alpha is raised again.
@@ -794,7 +1227,7 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
                 child_node_type = NodeType::PV;
             } 
             child_node_data.node_type = child_node_type;
-            eval = -negamax(board, next_depth, -beta, -alpha, childPV, child_node_data);
+            eval = -negamax(board, next_depth, -beta, -alpha, child_node_data);
             eval_adjust(eval);
         } else {
             // If we are in a PV node and search the next child on a null window, we expect
@@ -811,11 +1244,11 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
                 child_node_type = NodeType::ALL;
             }
             child_node_data.node_type = child_node_type;
-            eval = -negamax(board, next_depth, -(alpha + 1), -alpha, childPV, child_node_data);
+            eval = -negamax(board, next_depth, -(alpha + 1), -alpha, child_node_data);
             eval_adjust(eval);
         }
         
-        subtract_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+        st.accumulators.pop();
         board.unmakeMove(move);
     
         // If we raised alpha in a null window search or reduced depth search, re-search with full window and full depth.
@@ -827,15 +1260,15 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
             // Now this child becomes a PV node.
             child_node_data.node_type = NodeType::PV;
 
-            add_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
-            move_stack[thread_id][ply] = move_index(move);
+            st.accumulators.push(board, move);
+            st.piece_to_stack[ply] = piece_to_index(board, move);
             board.makeMove(move);
-            node_count[thread_id]++;
+            st.node_count++;
 
-            eval = -negamax(board, depth - 1, -beta, -alpha, childPV, child_node_data);
+            eval = -negamax(board, depth - 1, -beta, -alpha, child_node_data);
             eval_adjust(eval);
 
-            subtract_accumulators(board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+            st.accumulators.pop();
             board.unmakeMove(move);
         }
 
@@ -843,50 +1276,47 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
             best_eval = eval;
             if (best_eval > alpha) {
                 alpha = best_eval;
-                update_pv(PV, move, childPV);
+                update_pv(st, ply, move);
 
                 if (ply >= 2 && is_pv) {
-                    int move_index_2 = move_index(move_stack[thread_id][ply - 2]);
-                    int move_index_0 = move_index(move);
-                    mg_2ply[thread_id][stm].insert({move_index_2, move_index_0});
-                } 
+                    update_continuation(board, move, ply, false, st);
+                }
             }
         }
 
         if (eval < alpha && !is_capture) {
-            bad_quiets.push_back(move);
+            bad_quiets[bad_quiet_count++] = move;
         }
 
         // Beta cutoff.
         if (beta <= alpha) {
+            st.cutoffs++;
+            st.first_move_cutoffs += moves_searched == 1;
+
             int mv_index = move_index(move);
-            int currentScore = history[thread_id][stm][mv_index];
+            int currentScore = st.history[stm][mv_index];
             int limit = MAX_HIST;
             int delta = (1.0 - static_cast<float>(std::abs(currentScore)) / static_cast<float>(limit)) * depth * depth;
 
             // Update history scores for the move that caused the cutoff and the previous moves that failed to cutoffs.
             if (!is_capture) {
-                update_killers(move, ply, thread_id);
-                history[thread_id][stm][mv_index] += delta;
-                history[thread_id][stm][mv_index] = std::clamp(history[thread_id][stm][mv_index], -MAX_HIST, MAX_HIST);
+                update_killers(move, ply, st);
+                st.history[stm][mv_index] += delta;
+                st.history[stm][mv_index] = std::clamp(st.history[stm][mv_index], -MAX_HIST, MAX_HIST);
 
                 // penalize bad quiet moves
-                for (auto& bad_quiet : bad_quiets) {
-                    int bad_mv_idex = move_index(bad_quiet);
-                    history[thread_id][stm][bad_mv_idex] -= delta;
-                    history[thread_id][stm][bad_mv_idex] = std::clamp(history[thread_id][stm][bad_mv_idex], -MAX_HIST, MAX_HIST);
+                for (int j = 0; j < bad_quiet_count; j++) {
+                    int bad_mv_idex = move_index(bad_quiets[j]);
+                    st.history[stm][bad_mv_idex] -= delta;
+                    st.history[stm][bad_mv_idex] = std::clamp(st.history[stm][bad_mv_idex], -MAX_HIST, MAX_HIST);
                 }
             } 
 
             // combine follow-up and counter-move heuristics
             // we store the pair of moves in (ply - 2, ply) and (ply - 1, ply) that caused a beta cut-off
             if (ply >= 2) {
-                int move_index_2 = move_index(move_stack[thread_id][ply - 2]);
-                int move_index_1 = move_index(move_stack[thread_id][ply - 1]);
-                int move_index_0 = move_index(move);
-                mg_2ply[thread_id][stm].insert({move_index_2, move_index_0});
-                mg_2ply[thread_id][stm].insert({move_index_1, move_index_0});
-            } 
+                update_continuation(board, move, ply, true, st);
+            }
             break;
         } 
     }
@@ -910,8 +1340,8 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
             type = LOWERBOUND;
         } 
 
-        if (PV.size() > 0) {
-            table_insert(board, depth, best_eval, true, PV[0], type, tt_table);
+        if (st.pv_length[ply] > 0) {
+            table_insert(board, depth, best_eval, true, st.pv[ply][0], type, tt_table);
         } else {
             table_insert(board, depth, best_eval, true, Move::NO_MOVE, type, tt_table);
         }
@@ -923,8 +1353,8 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
         // IN ALL nodess, we have a fake beta. Similarly, we can only tell if best_eval is a UPPERBOUND if we have an alpha cutoff.
         if (best_eval >= beta) {
             EntryType type = LOWERBOUND;
-            if (PV.size() > 0) {
-                table_insert(board, depth, best_eval, false, PV[0], type, tt_table);
+            if (st.pv_length[ply] > 0) {
+                table_insert(board, depth, best_eval, false, st.pv[ply][0], type, tt_table);
             } else {
                 table_insert(board, depth, best_eval, false, Move::NO_MOVE, type, tt_table);
             }  
@@ -941,6 +1371,8 @@ int negamax(Board& board, int depth, int alpha, int beta, std::vector<Move>& PV,
 //     - Case 2: Stop if we reach the hard deadline or certain depth.
 std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_depth = 30, int time_limit = 15000, int thread_id = 0) {
 
+    SearchThread& st = *search_threads[thread_id];
+
     // Time management variables
     auto start_time = std::chrono::high_resolution_clock::now();
     hard_deadline = start_time + 2 * std::chrono::milliseconds(time_limit);
@@ -952,7 +1384,7 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
 
     std::vector<Move> root_moves (ENGINE_DEPTH + 1, Move::NO_MOVE);
     std::vector<int> evals (2 * ENGINE_DEPTH + 1, 0);
-    std::vector<std::pair<Move, int>> moves;
+    std::vector<Move> moves;
 
     Move best_move = Move(); 
     Move syzygy_move;
@@ -976,7 +1408,6 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
             try {
                 Board board_copy = board;
                 board_copy.makeMove(syzygy_move);
-                node_count[thread_id]++;
                 return {syzygy_move, 0, score, {syzygy_move}};
             } catch (const std::exception&) {
                 // In case somehow the move is invalid, continue with the search
@@ -984,15 +1415,19 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
         }
     }
     
+    // Moves are made on a copy with room for the undo states of the deepest line, so the tree never allocates
+    Board local_board = board;
+    local_board.reserveMoves(4 * ENGINE_DEPTH);
+
     // Start the search
-    int stand_pat = nnue.evaluate(white_accumulator[thread_id], black_accumulator[thread_id]);
+    AccumulatorPair& acc = st.accumulators.current(nnue);
+    int stand_pat = nnue.evaluate(acc.white, acc.black);
     int depth = 1;
     std::vector<Move> PV; 
 
     while (depth <= std::min(ENGINE_DEPTH, max_depth)) {
         Move curr_best_move = Move(); 
         int curr_best_eval = -INF;
-        bool hash_move_found = false;
 
         // Aspiration window
         int window_adjust = depth > 6 ? evals[depth - 1] / 16 : 0;
@@ -1000,8 +1435,19 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
         int alpha = (depth > 6) ? evals[depth - 1] - window : -INF;
         int beta  = (depth > 6) ? evals[depth - 1] + window : INF;
                 
-        moves = order_move(board, 0, thread_id, hash_move_found, NodeType::PV);
-        legal_moves_stack[thread_id][0] = moves.size();
+        // The root moves are picked once per iteration and reused by the re-searches of the aspiration loop
+        int tt_eval, tt_depth;
+        bool tt_pv;
+        Move tt_move = Move::NO_MOVE;
+        EntryType tt_type;
+        table_lookup(board, tt_depth, tt_eval, tt_pv, tt_move, tt_type, tt_table);
+
+        MovePicker picker(board, 0, st, tt_move);
+        moves.clear();
+        for (Move move = picker.next(); move != Move::NO_MOVE; move = picker.next()) {
+            moves.push_back(move);
+        }
+        st.legal_moves_stack[0] = moves.size();
 
         while (true) {
             curr_best_eval = -INF;
@@ -1010,13 +1456,11 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
             
             for (int i = 0; i < moves.size(); i++) {
 
-                Move move = moves[i].first;
-                Board local_board = board;
-                std::vector<Move> childPV; 
-                static_eval[thread_id][0] = stand_pat;
+                Move move = moves[i];
+                st.static_eval[0] = stand_pat;
 
                 int ply = 0;
-                int next_depth = late_move_reduction(local_board, move, i, depth, 0, true, NodeType::PV, thread_id);
+                int next_depth = late_move_reduction(local_board, move, i, depth, 0, true, NodeType::PV, st);
                 int eval = -INF;
 
                 NodeData child_node_data = {1, // ply of child node
@@ -1024,17 +1468,24 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
                                         depth, // root depth
                                         NodeType::PV, // child of a root node is a PV node
                                         Move::NO_MOVE, // no excluded move
-                                        thread_id};
+                                        &st};
                 
-                add_accumulators(local_board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
-                move_stack[thread_id][ply] = move_index(move);
+                tt_prefetch(local_board.hashAfter(move), tt_table);
+                st.accumulators.push(local_board, move);
+                st.piece_to_stack[ply] = piece_to_index(local_board, move);
                 local_board.makeMove(move);
-                node_count[thread_id]++;
-
-                eval = -negamax(local_board, next_depth, -beta, -alpha, childPV, child_node_data);
+                st.node_count++;
+
+#ifdef ALLOC_DEBUG
+                count_tree_allocations = true;
+#endif
+                eval = -negamax(local_board, next_depth, -beta, -alpha, child_node_data);
+#ifdef ALLOC_DEBUG
+                count_tree_allocations = false;
+#endif
                 eval_adjust(eval);
 
-                subtract_accumulators(local_board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+                st.accumulators.pop();
                 local_board.unmakeMove(move);
 
                 // Check for stop search flag
@@ -1044,15 +1495,21 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
 
                 if (eval > curr_best_eval && next_depth < depth - 1) {
                     // Re-search with full depth if we have a new best move
-                    add_accumulators(local_board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
-                    move_stack[thread_id][ply] = move_index(move);
+                    st.accumulators.push(local_board, move);
+                    st.piece_to_stack[ply] = piece_to_index(local_board, move);
                     local_board.makeMove(move);
-                    node_count[thread_id]++;
-
-                    eval = -negamax(local_board, depth - 1, -beta, -alpha, childPV, child_node_data);
+                    st.node_count++;
+
+#ifdef ALLOC_DEBUG
+                    count_tree_allocations = true;
+#endif
+                    eval = -negamax(local_board, depth - 1, -beta, -alpha, child_node_data);
+#ifdef ALLOC_DEBUG
+                    count_tree_allocations = false;
+#endif
                     eval_adjust(eval);
 
-                    subtract_accumulators(local_board, move, white_accumulator[thread_id], black_accumulator[thread_id], nnue);
+                    st.accumulators.pop();
                     local_board.unmakeMove(move);
 
                     if (stop_search) {
@@ -1065,7 +1522,8 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
                     curr_best_eval = eval;
                     curr_best_move = move;
                     alpha = std::max(alpha, curr_best_eval);
-                    update_pv(curr_pv, move, childPV);
+                    curr_pv.assign(1, move);
+                    curr_pv.insert(curr_pv.end(), st.pv[1], st.pv[1] + st.pv_length[1]);
                 } 
                 
                 if (alpha >= beta) {
@@ -1088,20 +1546,21 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
 
         table_insert(board, depth, best_eval, true, best_move, EntryType::EXACT, tt_table);
 
-        U64 total_node_count = 0, total_table_hit = 0;
-        for (int i = 0; i < MAX_THREADS; i++) {
-            total_node_count += node_count[i];
-            total_table_hit += table_hit[i];
+        U64 total_node_count = 0, total_table_hit = 0, total_tb_hits = 0;
+        for (auto& thread : search_threads) {
+            total_node_count += thread->node_count;
+            total_table_hit += thread->table_hit;
+            total_tb_hits += thread->tb_hits;
         }
     
         if (thread_id == 0){
             // Only print the analysis for the first thread to avoid clutter 
-            std::string analysis = format_analysis(depth, best_eval, total_node_count, total_table_hit, start_time, PV, board);
+            std::string analysis = format_analysis(depth, best_eval, total_node_count, total_table_hit, total_tb_hits, start_time, PV, board);
             std::cout << analysis << std::endl;
         }
 
         if (moves.size() == 1) {
-            return {moves[0].first, 0, stand_pat, {moves[0].first}}; // If there is only one move, return it immediately.
+            return {moves[0], 0, stand_pat, {moves[0]}}; // If there is only one move, return it immediately.
         }
 
         auto current_time = std::chrono::high_resolution_clock::now();
@@ -1132,74 +1591,129 @@ std::tuple<Move, int, int, std::vector<Move>> root_search(Board& board, int max_
     return {best_move, depth, best_eval, PV};
 }
 
-Move lazysmp_root_search(Board &board, int num_threads, int max_depth, int timeLimit) {
+// Start a lazy SMP search on the search pool and return immediately. Thread 0 is the main thread: once it
+// finishes, it stops the helpers, and the last worker to stop prints the final analysis and calls on_done.
+void start_search(Board &board, int num_threads, int max_depth, int time_limit, std::function<void(Move)> on_done) {
+    search_pool.wait(); // The previous search must be finished before we touch the thread data
+
     precompute_lmr(ENGINE_DEPTH, 500);  // Precompute late move reduction table
-    omp_set_num_threads(num_threads); // Set the number of threads for OpenMP
-    Move best_move = Move(); 
+    if (num_threads > thread_count) {
+        set_num_threads(num_threads);
+    }
     stop_search = false;
     auto start_time = std::chrono::high_resolution_clock::now();
 
-    // Update if the size for the transposition table changes
-    if (tt_table.size() != table_size) {
-        tt_table = std::vector<LockedTableEntry>(table_size);
-    }
+    tt_new_search();
+
+    for (auto& thread : search_threads) {
+        SearchThread& st = *thread;
 
-    for (int i = 0; i < MAX_THREADS; i++) {
         // Decay history scores
         for (int j = 0; j < 64 * 64; j++) {
-            history[i][0][j] /= 2;
-            history[i][1][j] /= 2;
+            st.history[0][j] /= 2;
+            st.history[1][j] /= 2;
         }
 
         for (int j = 0; j < ENGINE_DEPTH; j++) {
-            killer[i][j] = {Move::NO_MOVE, Move::NO_MOVE};
+            st.killer[j] = {Move::NO_MOVE, Move::NO_MOVE};
         }
         
-        node_count[i] = 0;
-        table_hit[i] = 0;
-        seeds[i] = rand();
+        st.node_count = 0;
+        st.table_hit = 0;
+        st.tb_hits = 0;
+        st.cutoffs = 0;
+        st.first_move_cutoffs = 0;
+        st.seed = rand();
 
-        mg_2ply[i][0].clear(); 
-        mg_2ply[i][1].clear();
+        st.poll_countdown = st.poll_interval = MIN_POLL_INTERVAL;
+        st.last_poll = start_time;
 
-        singular_moves[i][0] = {};
-        singular_moves[i][1] = {};
+#ifdef COUNTER_BENCH
+        st.mg_2ply[0].clear(); 
+        st.mg_2ply[1].clear();
+#endif
+
+        st.singular_moves[0].reset();
+        st.singular_moves[1].reset();
 
         // Make accumulators for each thread
-        make_accumulators(board, white_accumulator[i], black_accumulator[i], nnue);
-    }
-
-    int depth = -1;
-    int eval = -INF;
-    std::vector<Move> PV;
-
-    // Crude implementation of lazy SMP using OpenMP
-    #pragma omp parallel for schedule (static, 1)
-    for (int i = 0; i < num_threads; i++) {
-        Board local_board = board;
-        auto [thread_move, thread_depth, thread_eval, thread_pv] = root_search(local_board, max_depth, timeLimit, i);
-        if (i == 0) { 
-            // Get the result from thread 0
-            depth = thread_depth;
-            best_move = thread_move; 
-            eval = thread_eval; 
-            PV = thread_pv; 
+        st.accumulators.reset(board, nnue);
+    }
+
+    search_result = {Move(), -1, -INF, {}};
+    Board root_board = board;
+
+    auto search_task = [root_board, max_depth, time_limit](int thread_id) {
+        Board local_board = root_board;
+        age_continuation_history(*search_threads[thread_id]);
+        try {
+            auto [thread_move, thread_depth, thread_eval, thread_pv] = root_search(local_board, max_depth, time_limit, thread_id);
+            if (thread_id == 0) {
+                // Get the result from thread 0
+                search_result = {thread_move, thread_depth, thread_eval, thread_pv};
+            }
+        } catch (...) {
+            // Handle any exceptions during search
+        }
+
+        if (thread_id == 0) {
             stop_search = true; // Stop all threads
         }
-    }
+    };
+
+    auto report = [root_board, num_threads, start_time, on_done]() {
+        // Print the final analysis
+        U64 total_node_count = 0;
+        U64 total_table_hit = 0;
+        U64 total_tb_hits = 0;
+        for (int i = 0; i < num_threads; i++) {
+            total_node_count += search_threads[i]->node_count;
+            total_table_hit += search_threads[i]->table_hit;
+            total_tb_hits += search_threads[i]->tb_hits;
+        }
+
+        // Update benchmark_nodes with the actual node count from search
+        benchmark_nodes.store(total_node_count);
+
+        std::string analysis = format_analysis(search_result.depth, search_result.eval, total_node_count, total_table_hit, total_tb_hits, start_time, search_result.pv, root_board);
+        std::cout << analysis << std::endl;
+
+        if (on_done) {
+            on_done(search_result.best_move);
+        }
+    };
+
+    search_pool.start(num_threads, search_task, report);
+}
+
+// Block until the current search has finished and its result has been reported.
+void wait_search() {
+    search_pool.wait();
+}
 
-    // Print the final analysis
-    int total_node_count = 0;
-    int total_table_hit = 0;
-    for (int i = 0; i < num_threads; i++) {
-        total_node_count += node_count[i];
-        total_table_hit += table_hit[i];
+// WDL cache hits and misses, summed over all threads.
+std::pair<U64, U64> wdl_cache_stats() {
+    U64 hits = 0, misses = 0;
+    for (auto& thread : search_threads) {
+        hits += thread->wdl_cache_hits.load(std::memory_order_relaxed);
+        misses += thread->wdl_cache_misses.load(std::memory_order_relaxed);
     }
+    return {hits, misses};
+}
 
-    // Update benchmark_nodes with the actual node count from search
-    benchmark_nodes.store(total_node_count);
+// Beta cutoffs and first-move beta cutoffs of the last search, summed over all threads.
+std::pair<U64, U64> cutoff_stats() {
+    U64 cutoffs = 0, first_move_cutoffs = 0;
+    for (auto& thread : search_threads) {
+        cutoffs += thread->cutoffs;
+        first_move_cutoffs += thread->first_move_cutoffs;
+    }
+    return {cutoffs, first_move_cutoffs};
+}
 
-    std::string analysis = format_analysis(depth, eval, total_node_count, total_table_hit, start_time, PV, board);
-    std::cout << analysis << std::endl;
-    return best_move; 
-}
\ No newline at end of file
+// Blocking lazy SMP search.
+Move lazysmp_root_search(Board &board, int num_threads, int max_depth, int time_limit) {
+    start_search(board, num_threads, max_depth, time_limit, nullptr);
+    search_pool.wait();
+    return search_result.best_move;
+}
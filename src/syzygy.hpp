@@ -3,6 +3,7 @@
 #include "chess.hpp"
 #include "../lib/fathom/src/tbprobe.h"
 #include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
 
@@ -11,7 +12,46 @@ namespace syzygy {
     using namespace chess;
     using U64 = std::uint64_t; 
 
+    // Make a tablebase file embedded in the executable available to the next initialize_syzygy.
+    // The name may include a directory, only the file name is used.
+    inline void add_embedded_table(const std::string& name, const unsigned char* data, size_t size) {
+        std::string file_name = name.substr(name.find_last_of("/\\") + 1);
+        if (!tb_add_memory_file(file_name.c_str(), data, size)) {
+            std::cerr << "Failed to register embedded table " << file_name << std::endl;
+        }
+    }
+
+    // Lock-free WDL result cache shared by all search threads. Each slot packs the upper bits of the zobrist hash
+    // with the result in the low 2 bits (wdl + 2, so an empty slot never matches). A racing write simply replaces
+    // the slot and the key check rejects anything that does not belong to the probed position.
+    constexpr size_t WDL_CACHE_SIZE = 1 << 16;
+    constexpr U64 WDL_CACHE_KEY_MASK = ~U64(3);
+
+    inline std::atomic<U64> wdl_cache[WDL_CACHE_SIZE];
+
+    inline void clear_wdl_cache() {
+        for (auto& slot : wdl_cache) {
+            slot.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // hits and misses are counted per search thread by the callers of probe_wdl
+    inline void print_wdl_cache_stats(U64 hits, U64 misses) {
+        U64 used = 0;
+        for (auto& slot : wdl_cache) {
+            used += slot.load(std::memory_order_relaxed) != 0;
+        }
+
+        std::cout << "WDL cache hits: " << hits << std::endl;
+        std::cout << "WDL cache misses: " << misses << std::endl;
+        std::cout << "WDL cache hit rate: " << (hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0) << "%" << std::endl;
+        std::cout << "WDL cache usage: " << used << "/" << WDL_CACHE_SIZE << std::endl;
+    }
+
+    // Initialize the tablebases from the embedded tables and the directories in path.
+    // "<empty>" uses only the embedded tables.
     inline void initialize_syzygy(std::string path) {
+        clear_wdl_cache();
         std::cout << "Initializing endgame table at path: " << path << std::endl;
         if (!tb_init(path.c_str())) {
             std::cerr << "Failed to initialize endgame table." << std::endl;
@@ -20,7 +60,55 @@ namespace syzygy {
         }
     }
     
+    // Whether the position can be probed at all: few enough pieces for the loaded tables
+    inline bool probeable(const Board& board) {
+        return TB_LARGEST > 0 && board.occ().count() <= static_cast<int>(TB_LARGEST);
+    }
+
+    // Cheap WDL probe for use inside the search tree. fathom only answers WDL probes for positions
+    // without castling rights right after a zeroing move, so anything else is rejected before probing.
+    // wdl is 1 for a win, -1 for a loss and 0 for a draw, including wins and losses spoiled by the 50-move rule.
+    // Lookups in the WDL cache are counted in the caller's cache_hits and cache_misses. The caller is their only
+    // writer, so a relaxed load and store is enough and tbstats can read them while a search runs.
+    inline bool probe_wdl(const Board& board, int& wdl, std::atomic<U64>& cache_hits, std::atomic<U64>& cache_misses) {
+        if (!probeable(board) || board.halfMoveClock() != 0 || !board.castlingRights().isEmpty()) {
+            return false;
+        }
+
+        U64 hash = board.hash();
+        std::atomic<U64>& slot = wdl_cache[hash & (WDL_CACHE_SIZE - 1)];
+        U64 cached = slot.load(std::memory_order_relaxed);
+        if (cached != 0 && (cached & WDL_CACHE_KEY_MASK) == (hash & WDL_CACHE_KEY_MASK)) {
+            cache_hits.store(cache_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            wdl = static_cast<int>(cached & 3) - 2;
+            return true;
+        }
+        cache_misses.store(cache_misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        unsigned ep = (board.enpassantSq() != Square::underlying::NO_SQ) ? board.enpassantSq().index() : 0;
+        unsigned result = tb_probe_wdl(
+            board.us(Color::WHITE).getBits(), board.us(Color::BLACK).getBits(),
+            board.pieces(PieceType::KING).getBits(), board.pieces(PieceType::QUEEN).getBits(),
+            board.pieces(PieceType::ROOK).getBits(), board.pieces(PieceType::BISHOP).getBits(),
+            board.pieces(PieceType::KNIGHT).getBits(), board.pieces(PieceType::PAWN).getBits(),
+            0, 0, ep, board.sideToMove() == Color::WHITE
+        );
+
+        if (result == TB_RESULT_FAILED) {
+            return false;
+        }
+
+        wdl = (result == TB_WIN) ? 1 : (result == TB_LOSS) ? -1 : 0;
+        slot.store((hash & WDL_CACHE_KEY_MASK) | static_cast<U64>(wdl + 2), std::memory_order_relaxed);
+        return true;
+    }
+
+    // Root probe. Uses the DTZ tables to pick a move that preserves the result, falling back to WDL.
     inline bool probe_syzygy(const Board& board, Move& suggestedMove, int& wdl) {
+        if (!probeable(board)) {
+            return false;
+        }
+
         // Convert the board to bitboard representation
         U64 white = board.us(Color::WHITE).getBits();
         U64 black = board.us(Color::BLACK).getBits();
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads. Workers park on a condition variable between tasks, so starting a
+// search does not pay for thread creation or OpenMP runtime setup.
+// A task runs on workers 0..n-1. The last worker to finish runs the completion callback, after which
+// the pool is idle again.
+class ThreadPool {
+public:
+    ThreadPool() = default;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        shutdown();
+    }
+
+    int size() const {
+        return static_cast<int>(workers.size());
+    }
+
+    // Replace the workers with num_threads fresh ones. Must only be called while the pool is idle.
+    void resize(int num_threads) {
+        shutdown();
+
+        quit = false;
+        for (int i = 0; i < num_threads; i++) {
+            workers.emplace_back(&ThreadPool::worker_loop, this, i, task_id);
+        }
+    }
+
+    // Run task(thread_id) on the first num_threads workers and return immediately.
+    // The pool must have at least one worker.
+    void start(int num_threads, std::function<void(int)> new_task, std::function<void()> new_on_done = nullptr) {
+        wait();
+
+        std::lock_guard<std::mutex> lock(mtx);
+        task = std::move(new_task);
+        on_done = std::move(new_on_done);
+        task_threads = std::clamp(num_threads, 1, size());
+        running = task_threads;
+        busy = true;
+        task_id++;
+        cv_start.notify_all();
+    }
+
+    // Block until the current task and its completion callback have finished.
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_done.wait(lock, [this] { return !busy; });
+    }
+
+private:
+    void shutdown() {
+        if (workers.empty()) return;
+
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            quit = true;
+        }
+        cv_start.notify_all();
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    void worker_loop(int thread_id, uint64_t last_task) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv_start.wait(lock, [&] { return quit || task_id != last_task; });
+                if (quit) return;
+
+                last_task = task_id;
+                if (thread_id >= task_threads) continue;
+            }
+
+            task(thread_id);
+
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                last = (--running == 0);
+            }
+
+            if (last) {
+                if (on_done) on_done();
+
+                std::lock_guard<std::mutex> lock(mtx);
+                busy = false;
+                cv_done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable cv_start;
+    std::condition_variable cv_done;
+
+    std::function<void(int)> task;
+    std::function<void()> on_done;
+    uint64_t task_id = 0;
+    int task_threads = 0;
+    int running = 0;
+    bool busy = false;
+    bool quit = false;
+};
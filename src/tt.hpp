@@ -0,0 +1,258 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "chess.hpp"
+
+#ifdef _WIN32
+    #include <malloc.h>
+#elif __linux__
+    #include <sys/mman.h>
+#endif
+
+using namespace chess;
+
+// tt entry definition
+enum EntryType {
+    EXACT,
+    LOWERBOUND,
+    UPPERBOUND
+};
+
+constexpr int BUCKET_SIZE = 4; // Entries per cache-line bucket
+constexpr int GENERATION_BITS = 5;
+constexpr int GENERATION_MASK = (1 << GENERATION_BITS) - 1;
+
+// Lock-free tt entry (lockless hashing, Hyatt & Mann). The data word packs the whole entry and the key word
+// stores hash ^ data. Both words are written and read independently without a lock; if another thread wrote
+// one of them in between (a torn read), key ^ data no longer matches the hash and the probe is a miss.
+//
+// Data layout:
+// bits  0-15 : best move
+// bits 16-23 : depth (int8, clamped: extensions can take it past ENGINE_DEPTH)
+// bits 24-25 : entry type
+// bit  26    : pv flag
+// bits 27-31 : generation of the search that wrote the entry
+// bits 32-63 : eval (int32)
+struct TableEntry {
+    std::atomic<uint64_t> key;
+    std::atomic<uint64_t> data;
+};
+
+// A bucket fills one cache line, so a probe touches a single line but can hit any of its entries.
+struct alignas(64) TableBucket {
+    TableEntry entries[BUCKET_SIZE];
+};
+
+// Generation of the current search. Bumped once per "go" so that entries from older searches age out.
+inline uint8_t tt_generation = 0;
+
+inline void tt_new_search() {
+    tt_generation = (tt_generation + 1) & GENERATION_MASK;
+}
+
+// Maps a hash to a bucket index with a multiply-shift (the high 64 bits of hash * size),
+// which avoids a 64-bit division per probe and works for any table size.
+inline uint64_t tt_index(uint64_t hash, uint64_t size) {
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * size) >> 64);
+}
+
+// Table memory. On Linux the table is aligned to 2 MB and advised to use transparent huge pages, falling back to
+// explicit 2 MB pages from the hugetlbfs pool, since TLB misses dominate probe latency for large tables.
+// Memory is not touched on allocation. It is zeroed in parallel so that each search thread first-touches its
+// own slice, which places the pages on that thread's NUMA node.
+struct TranspositionTable {
+    TableBucket* buckets = nullptr;
+    uint64_t size = 0; // Number of buckets
+    size_t bytes = 0;
+    bool huge_tlb = false; // Allocated with mmap(MAP_HUGETLB)
+
+    TranspositionTable() = default;
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+    ~TranspositionTable() { release(); }
+
+    TableBucket& bucket(uint64_t hash) {
+        return buckets[tt_index(hash, size)];
+    }
+
+    // Memory is left untouched. It must be zeroed with clear_slice before use.
+    void resize(size_t mb) {
+        release();
+
+        size = std::max<uint64_t>(1, mb * 1024 * 1024 / sizeof(TableBucket));
+        bytes = size * sizeof(TableBucket);
+
+#ifdef _WIN32
+        buckets = static_cast<TableBucket*>(_aligned_malloc(bytes, alignof(TableBucket)));
+#elif __linux__
+        constexpr size_t huge_page_size = 2 * 1024 * 1024;
+        bytes = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+        void* mem = std::aligned_alloc(huge_page_size, bytes);
+
+        if (mem != nullptr && madvise(mem, bytes, MADV_HUGEPAGE) != 0) {
+    #ifdef MAP_HUGETLB
+            void* huge = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (huge != MAP_FAILED) {
+                std::free(mem);
+                mem = huge;
+                huge_tlb = true;
+            }
+    #endif
+        }
+        buckets = static_cast<TableBucket*>(mem);
+#else
+        buckets = static_cast<TableBucket*>(std::aligned_alloc(alignof(TableBucket), bytes));
+#endif
+
+        if (buckets == nullptr) {
+            std::cerr << "Failed to allocate " << mb << " MB for the transposition table" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+    }
+
+    // Zero slice i of n contiguous slices. Each search thread clears its own slice.
+    void clear_slice(int i, int n) {
+        uint64_t start = size * i / n;
+        uint64_t end = size * (i + 1) / n;
+        std::memset(static_cast<void*>(buckets + start), 0, (end - start) * sizeof(TableBucket));
+    }
+
+    void release() {
+        if (buckets == nullptr) return;
+
+#ifdef _WIN32
+        _aligned_free(buckets);
+#elif __linux__
+        if (huge_tlb) {
+            munmap(buckets, bytes);
+        } else {
+            std::free(buckets);
+        }
+#else
+        std::free(buckets);
+#endif
+        buckets = nullptr;
+        size = 0;
+        bytes = 0;
+        huge_tlb = false;
+    }
+};
+
+// Start fetching the bucket of a position we are about to search, so that the cache miss
+// overlaps with the accumulator update and makeMove.
+inline void tt_prefetch(uint64_t hash, TranspositionTable& table) {
+    __builtin_prefetch(&table.bucket(hash));
+}
+
+inline uint64_t pack_entry(int depth, int eval, bool pv, Move best_move, EntryType type) {
+    return static_cast<uint64_t>(best_move.move())
+        | static_cast<uint64_t>(static_cast<uint8_t>(std::clamp(depth, INT8_MIN, INT8_MAX))) << 16
+        | static_cast<uint64_t>(type) << 24
+        | static_cast<uint64_t>(pv) << 26
+        | static_cast<uint64_t>(tt_generation) << 27
+        | static_cast<uint64_t>(static_cast<uint32_t>(eval)) << 32;
+}
+
+inline void unpack_entry(uint64_t data, int& depth, int& eval, bool& pv, Move& best_move, EntryType& type) {
+    best_move = Move(static_cast<uint16_t>(data));
+    depth = static_cast<int8_t>(data >> 16);
+    type = static_cast<EntryType>((data >> 24) & 3);
+    pv = (data >> 26) & 1;
+    eval = static_cast<int32_t>(data >> 32);
+}
+
+inline int entry_depth(uint64_t data) {
+    return static_cast<int8_t>(data >> 16);
+}
+
+// Number of searches since the entry was written
+inline int entry_age(uint64_t data) {
+    return (tt_generation - static_cast<int>((data >> 27) & GENERATION_MASK)) & GENERATION_MASK;
+}
+
+// transposition table lookup function
+inline bool table_lookup(Board& board,
+    int& depth,
+    int& eval,
+    bool& pv,
+    Move& best_move,
+    EntryType& type,
+    TranspositionTable& table) {
+
+    uint64_t hash = board.hash();
+    TableBucket& bucket = table.bucket(hash);
+
+    for (auto& entry : bucket.entries) {
+        uint64_t data = entry.data.load(std::memory_order_relaxed);
+        uint64_t key = entry.key.load(std::memory_order_relaxed);
+
+        if ((key ^ data) == hash) {
+            unpack_entry(data, depth, eval, pv, best_move, type);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// transposition table insert function
+// An entry with the same hash is updated in place. Otherwise we replace the entry with the lowest
+// depth, where entries from older searches are treated as shallower the older they are.
+inline void table_insert(Board& board,
+    int depth,
+    int eval,
+    bool pv,
+    Move best_move,
+    EntryType type,
+    TranspositionTable& table) {
+
+    uint64_t hash = board.hash();
+    TableBucket& bucket = table.bucket(hash);
+    TableEntry* replace = nullptr;
+    int replace_score = INT_MAX;
+
+    for (auto& entry : bucket.entries) {
+        uint64_t old_data = entry.data.load(std::memory_order_relaxed);
+        uint64_t old_key = entry.key.load(std::memory_order_relaxed);
+
+        if ((old_key ^ old_data) == hash) {
+            int old_depth, old_eval;
+            bool old_pv;
+            Move old_move;
+            EntryType old_type;
+            unpack_entry(old_data, old_depth, old_eval, old_pv, old_move, old_type);
+
+            if (old_pv) {
+                pv = true; // don't overwrite the pv node if it was set
+            }
+
+            if (depth == old_depth && type == EntryType::UPPERBOUND && entry_age(old_data) == 0) {
+                return; // if the existing entry has the same depth, don't overwrite it with an upperbound
+            }
+
+            if (best_move == Move::NO_MOVE) {
+                best_move = old_move; // keep the old best move if we don't have one
+            }
+
+            replace = &entry;
+            break;
+        }
+
+        int score = entry_depth(old_data) - 8 * entry_age(old_data);
+        if (score < replace_score) {
+            replace_score = score;
+            replace = &entry;
+        }
+    }
+
+    uint64_t data = pack_entry(depth, eval, pv, best_move, type);
+    replace->key.store(hash ^ data, std::memory_order_relaxed);
+    replace->data.store(data, std::memory_order_relaxed);
+}
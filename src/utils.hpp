@@ -13,6 +13,7 @@ inline std::string format_analysis(
     int bestEval,
     size_t totalNodeCount,
     size_t totalTableHit,
+    size_t totalTbHits,
     const std::chrono::high_resolution_clock::time_point& startTime,
     const std::vector<Move>& PV,
     const Board& board
@@ -26,6 +27,7 @@ inline std::string format_analysis(
     int best_eval,
     size_t total_node_count,
     size_t total_table_hit,
+    size_t total_tb_hits,
     const std::chrono::high_resolution_clock::time_point& start_time,
     const std::vector<Move>& pv,
     const Board& board
@@ -33,6 +35,7 @@ inline std::string format_analysis(
     std::string depth_str = "depth " + std::to_string(depth) + " seldepth " + std::to_string(std::max(size_t(depth), pv.size()));
     std::string score_str = "score cp " + std::to_string(best_eval / 2);
     std::string node_str = "nodes " + std::to_string(total_node_count);
+    std::string tb_hits_str = "tbhits " + std::to_string(total_tb_hits);
     std::string table_hit_str = "tableHit " + std::to_string(
         static_cast<double>(total_table_hit) / total_node_count
     );
@@ -56,7 +59,7 @@ inline std::string format_analysis(
         pv_str += uci::moveToUci(move, board.chess960()) + " ";
     }
 
-    std::string analysis = "info " + depth_str + " " + score_str + " " + node_str + " " + nps_str + " " + time_str + " " + pv_str;
+    std::string analysis = "info " + depth_str + " " + score_str + " " + node_str + " " + nps_str + " " + tb_hits_str + " " + time_str + " " + pv_str;
     return analysis;
 }
 